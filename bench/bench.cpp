@@ -0,0 +1,185 @@
+#include <bench.hpp>
+#include <source.hpp>
+
+#include <atomic>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <new>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+std::atomic<size_t> allocations{ 0 };
+}
+
+void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+size_t allocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+size_t residentBytes()
+{
+    malloc_trim(0);
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+size_t peakResidentBytes()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss) * 1024;
+}
+
+Result<std::vector<SampleRecord>> loadSample(const std::string& name)
+{
+    std::ifstream input(std::string(BENCH_DATA_DIR "/") + name);
+    if (!input.is_open()) {
+        return ERROR("can't open sample " + name);
+    }
+
+    std::vector<SampleRecord> records;
+    std::string line;
+    while (std::getline(input, line)) {
+        if (line.compare(0, 5, "type=") != 0) {
+            continue;
+        }
+        int type;
+        std::string_view message;
+        if (!parseRecordLine(line, type, message)) {
+            return ERROR("malformed sample line: " + line);
+        }
+        records.push_back({ type, std::string(message) });
+    }
+    return std::move(records);
+}
+
+Result<> CountingRuleSink::addRule(audit_rule_data*)
+{
+    this->added++;
+    return NO_ERROR;
+}
+
+Result<> CountingRuleSink::deleteRule(audit_rule_data*)
+{
+    this->deleted++;
+    return NO_ERROR;
+}
+
+SyntheticTree::~SyntheticTree()
+{
+    std::error_code err;
+    std::filesystem::remove_all(this->root, err);
+}
+
+Result<std::shared_ptr<SyntheticTree>> SyntheticTree::create(
+    const TreeShape& shape)
+{
+    char pattern[] = "/tmp/dirwatch-bench-XXXXXX";
+    if (mkdtemp(pattern) == nullptr) {
+        return ERROR("can't create temporary directory");
+    }
+    auto tree = std::shared_ptr<SyntheticTree>(new SyntheticTree());
+    tree->shape = shape;
+    tree->root = pattern;
+
+    std::vector<std::pair<std::string, size_t>> pending = { { tree->root, 0 } };
+    while (!pending.empty()) {
+        auto [dir, depth] = pending.back();
+        pending.pop_back();
+        tree->dirs.push_back(dir);
+
+        for (size_t i = 0; i < shape.files; ++i) {
+            auto path = dir + "/file" + std::to_string(i);
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                return ERROR("can't create " + path);
+            }
+            close(fd);
+            tree->files.push_back(path);
+        }
+        if (depth == shape.depth) {
+            continue;
+        }
+        for (size_t i = 0; i < shape.fanout; ++i) {
+            auto path = dir + "/dir" + std::to_string(i);
+            std::error_code err;
+            if (!std::filesystem::create_directory(path, err)) {
+                return ERROR("can't create " + path);
+            }
+            pending.emplace_back(path, depth + 1);
+        }
+    }
+    return std::move(tree);
+}
+
+Result<std::shared_ptr<SyntheticTree>> treeFromArgs(int argc,
+                                                    char** argv,
+                                                    TreeShape defaults)
+{
+    size_t* fields[] = { &defaults.depth, &defaults.fanout, &defaults.files };
+    size_t next = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") == 0) {
+            continue;
+        }
+        if (next == std::size(fields)) {
+            return ERROR("too many arguments: " + arg);
+        }
+        size_t end = 0;
+        try {
+            *fields[next] = std::stoul(arg, &end);
+        } catch (const std::exception&) {
+        }
+        if (end == 0 || end != arg.size()) {
+            return ERROR("not a number: " + arg);
+        }
+        ++next;
+    }
+    return SyntheticTree::create(defaults);
+}
+
+Stopwatch::Stopwatch()
+    : start(std::chrono::steady_clock::now())
+{}
+
+double Stopwatch::seconds() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         this->start)
+        .count();
+}
+
+void report(const std::string& name, double value, const std::string& unit)
+{
+    std::cout << std::left << std::setw(48) << name << std::right
+              << std::setw(14) << std::fixed << std::setprecision(2) << value
+              << " " << unit << std::endl;
+}
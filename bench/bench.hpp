@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <util.hpp>
+#include <watch.hpp>
+
+// Shared helpers for the programs in bench/. Every benchmark binary links
+// bench.cpp, which replaces the global allocation functions with counting
+// versions.
+
+// Number of heap allocations made by the process so far.
+size_t allocationCount();
+
+// Current resident set size of the process, after returning free heap
+// memory to the system.
+size_t residentBytes();
+
+// Highest resident set size the process has had so far.
+size_t peakResidentBytes();
+
+struct SampleRecord
+{
+    int type;
+    std::string message;
+};
+
+// Reads records in the audisp text format ("type=NAME msg=audit(...): ...")
+// from bench/data.
+Result<std::vector<SampleRecord>> loadSample(const std::string& name);
+
+// Accepts every rule without talking to the kernel, and counts them.
+class CountingRuleSink : public RuleSink
+{
+public:
+    size_t added = 0;
+    size_t deleted = 0;
+
+    Result<> addRule(audit_rule_data* rule) override;
+    Result<> deleteRule(audit_rule_data* rule) override;
+
+    size_t installed() const { return this->added - this->deleted; }
+};
+
+struct TreeShape
+{
+    size_t depth;
+    // subdirectories per directory
+    size_t fanout;
+    // regular files per directory
+    size_t files;
+};
+
+// A generated directory tree in a temporary directory, removed on
+// destruction.
+class SyntheticTree
+{
+    SyntheticTree() = default;
+
+public:
+    TreeShape shape;
+    std::string root;
+    std::vector<std::string> dirs;
+    std::vector<std::string> files;
+
+    SyntheticTree(const SyntheticTree&) = delete;
+    SyntheticTree& operator=(const SyntheticTree&) = delete;
+
+    ~SyntheticTree();
+
+    static Result<std::shared_ptr<SyntheticTree>> create(
+        const TreeShape& shape);
+};
+
+// Creates a tree with the shape given by the numeric arguments, depth,
+// fanout and files in that order, taking the rest from defaults. Arguments
+// starting with "--" are left to the caller.
+Result<std::shared_ptr<SyntheticTree>> treeFromArgs(int argc,
+                                                    char** argv,
+                                                    TreeShape defaults);
+
+class Stopwatch
+{
+    std::chrono::steady_clock::time_point start;
+
+public:
+    Stopwatch();
+
+    double seconds() const;
+};
+
+// Prints a single "name: value unit" result line.
+void report(const std::string& name, double value, const std::string& unit);
+
+// Keeps the compiler from optimizing away a computed value.
+template<class T>
+void keep(const T& value)
+{
+    asm volatile("" : : "r"(&value) : "memory");
+}
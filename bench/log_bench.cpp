@@ -0,0 +1,262 @@
+#include <bench.hpp>
+#include <eventlog.hpp>
+#include <rotation.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Writes the same accesses to the text log, to the rotated and compressed
+// text log and to the binary log, and compares the time per entry and the
+// size on disk. Coalescing is measured separately, on bursts of reads like
+// those of a process reading a file in small chunks. The binary log is then
+// exported back to text, which has to give the text log byte for byte. It's
+// written by two BinaryLog instances one after the other, with small
+// segments, so continuing a log and switching segments are covered too.
+//
+// usage: log_bench [entries] [distinct paths]
+
+namespace {
+
+constexpr size_t segmentBytes = 4 << 20;
+
+const std::string_view users[] = { "root", "lipk", "www-data", "postgres" };
+const std::string_view comms[] = { "cat", "bash", "vim", "rsync", "python3" };
+
+struct Access
+{
+    size_t path;
+    size_t user;
+    size_t comm;
+    AccessType access;
+    std::string pid;
+};
+
+LogEntry entryOf(const Access& access,
+                 long timestamp,
+                 const std::vector<std::string>& paths)
+{
+    return LogEntry{ timestamp,
+                     paths[access.path],
+                     access.access,
+                     access.pid,
+                     "1000",
+                     users[access.user],
+                     comms[access.comm] };
+}
+
+// disk space taken, the unused end of the last segment is sparse
+size_t directoryBytes(const std::string& directory)
+{
+    size_t bytes = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        struct stat st;
+        if (stat(entry.path().c_str(), &st) == 0) {
+            bytes += size_t(st.st_blocks) * 512;
+        }
+    }
+    return bytes;
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream input(path, std::ios::binary);
+    std::stringstream data;
+    data << input.rdbuf();
+    return data.str();
+}
+
+Result<> run(const std::string& directory, size_t count, size_t pathCount)
+{
+    std::mt19937 rng(42);
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < pathCount; ++i) {
+        paths.push_back("/srv/data/project" + std::to_string(i % 97) +
+                        "/src/module" + std::to_string(i) + "/file.cpp");
+    }
+    std::vector<Access> accesses;
+    for (size_t i = 0; i < count; ++i) {
+        accesses.push_back({ rng() % pathCount,
+                             rng() % std::size(users),
+                             rng() % std::size(comms),
+                             AccessType(rng() % 6),
+                             std::to_string(1000 + rng() % 30000) });
+    }
+    const long firstTimestamp = 1700000000;
+
+    auto textPath = directory + "/text.log";
+    {
+        Config config;
+        config.outputPath = textPath;
+        RETURN_OR_SET(auto log, openEventLog(config));
+        Stopwatch timer;
+        for (size_t i = 0; i < count; ++i) {
+            RETURN_IF_ERROR(
+                log->append(entryOf(accesses[i], firstTimestamp + i, paths)));
+        }
+        RETURN_IF_ERROR(log->flush());
+        report("text append", timer.seconds() * 1e9 / count, "ns/entry");
+    }
+    report("text size",
+           double(std::filesystem::file_size(textPath)) / count,
+           "B/entry");
+
+    auto rotatedPath = directory + "/rotated";
+    std::filesystem::create_directory(rotatedPath);
+    Config rotated;
+    rotated.outputPath = rotatedPath + "/dirwatch.log";
+    rotated.rotateBytes = segmentBytes;
+    rotated.compress = !SegmentFile::extension(true).empty();
+    std::string rotatedName = rotated.compress ? "compressed" : "rotated";
+    {
+        RETURN_OR_SET(auto log, openEventLog(rotated));
+        Stopwatch timer;
+        for (size_t i = 0; i < count; ++i) {
+            RETURN_IF_ERROR(
+                log->append(entryOf(accesses[i], firstTimestamp + i, paths)));
+        }
+        RETURN_IF_ERROR(log->flush());
+        report(rotatedName + " append",
+               timer.seconds() * 1e9 / count,
+               "ns/entry");
+        // waits for the background thread
+        log.reset();
+        report(rotatedName + " append+write",
+               timer.seconds() * 1e9 / count,
+               "ns/entry");
+    }
+    report(rotatedName + " size",
+           double(directoryBytes(rotatedPath)) / count,
+           "B/entry");
+    report(rotatedName + " files",
+           std::distance(std::filesystem::directory_iterator(rotatedPath),
+                         std::filesystem::directory_iterator()),
+           "");
+
+    auto binaryPath = directory + "/binary";
+    {
+        Stopwatch timer;
+        const std::pair<size_t, size_t> halves[] = { { 0, count / 2 },
+                                                     { count / 2, count } };
+        for (const auto& [first, last] : halves) {
+            RETURN_OR_SET(auto log,
+                          BinaryLog::create(binaryPath, segmentBytes));
+            for (size_t i = first; i < last; ++i) {
+                RETURN_IF_ERROR(log->append(
+                    entryOf(accesses[i], firstTimestamp + i, paths)));
+            }
+            RETURN_IF_ERROR(log->flush());
+        }
+        report("binary append", timer.seconds() * 1e9 / count, "ns/entry");
+    }
+    report("binary size",
+           double(directoryBytes(binaryPath)) / count,
+           "B/entry");
+
+    std::string exported, line;
+    size_t entries = 0;
+    Stopwatch timer;
+    RETURN_IF_ERROR(
+        readBinaryLog(binaryPath, [&](const LogEntry& entry) -> Result<> {
+            formatLogLine(entry, line);
+            exported.append(line);
+            entries++;
+            return NO_ERROR;
+        }));
+    report("binary export", timer.seconds() * 1e9 / entries, "ns/entry");
+
+    if (exported != readFile(textPath)) {
+        return ERROR("exported binary log differs from the text log");
+    }
+    return NO_ERROR;
+}
+
+// Every process reads a file in bursts of readsPerFile reads. The timestamp
+// advances once per entriesPerSecond entries.
+Result<> runCoalescing(const std::string& directory,
+                       size_t count,
+                       size_t pathCount)
+{
+    constexpr size_t readsPerFile = 64;
+    constexpr size_t entriesPerSecond = 10000;
+    constexpr size_t processes = 100;
+
+    std::vector<std::string> paths, pids;
+    for (size_t i = 0; i < pathCount; ++i) {
+        paths.push_back("/srv/data/file" + std::to_string(i));
+    }
+    for (size_t i = 0; i < processes; ++i) {
+        pids.push_back(std::to_string(1000 + i));
+    }
+
+    Config config;
+    config.outputPath = directory + "/coalesced.log";
+    config.coalesceWindowSec = 5;
+    {
+        RETURN_OR_SET(auto log, openEventLog(config));
+        Stopwatch timer;
+        for (size_t i = 0; i < count; ++i) {
+            // interleaves the bursts of different processes
+            size_t process = i % processes;
+            size_t burst = i / processes / readsPerFile;
+            const auto& path = paths[(burst * processes + process) % pathCount];
+            RETURN_IF_ERROR(log->append(LogEntry{
+                long(1700000000 + i / entriesPerSecond),
+                path,
+                AccessType::Read,
+                pids[process],
+                "1000",
+                "lipk",
+                "cat" }));
+        }
+        RETURN_IF_ERROR(log->flush());
+        report("coalesce append", timer.seconds() * 1e9 / count, "ns/entry");
+    }
+
+    std::ifstream input(config.outputPath);
+    std::string line;
+    size_t lines = 0, accesses = 0;
+    while (std::getline(input, line)) {
+        // count is the next to last field
+        auto end = line.rfind('\t');
+        auto start = line.rfind('\t', end - 1) + 1;
+        accesses += std::stoul(line.substr(start, end - start));
+        lines++;
+    }
+    if (accesses != count) {
+        return ERROR("coalesced log has " + std::to_string(accesses) +
+                     " accesses instead of " + std::to_string(count));
+    }
+    report("coalesce lines", lines, "");
+    report("coalesce reduction", double(count) / lines, "x");
+    return NO_ERROR;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t pathCount = argc > 2 ? std::stoul(argv[2]) : 10000;
+
+    char directory[] = "/tmp/dirwatch-bench-XXXXXX";
+    if (mkdtemp(directory) == nullptr) {
+        std::cerr << "can't create temporary directory" << std::endl;
+        return 1;
+    }
+    auto res = run(directory, count, pathCount);
+    if (!res.isError()) {
+        res = runCoalescing(directory, count, pathCount);
+    }
+    std::error_code err;
+    std::filesystem::remove_all(directory, err);
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <bench.hpp>
+#include <watch.hpp>
+
+#include <iostream>
+#include <string.h>
+
+// Resident memory taken by the watch tree of a generated tree in per-file
+// mode. The rules are released once installed; for comparison, the second
+// run keeps a copy of every installed rule, as watches used to until they
+// were deleted.
+//
+// usage: memory_bench [depth] [fanout] [files]
+
+namespace {
+
+// Keeps every added rule in memory until it's deleted
+class RetainingRuleSink : public CountingRuleSink
+{
+    std::vector<audit_rule_data*> rules;
+
+public:
+    ~RetainingRuleSink()
+    {
+        for (auto rule : this->rules) {
+            free(rule);
+        }
+    }
+
+    Result<> addRule(audit_rule_data* rule) override
+    {
+        size_t size = sizeof(audit_rule_data) + rule->buflen;
+        auto copy = reinterpret_cast<audit_rule_data*>(malloc(size));
+        memcpy(copy, rule, size);
+        this->rules.push_back(copy);
+        return CountingRuleSink::addRule(rule);
+    }
+};
+
+Result<> measure(const std::string& name,
+                 const SyntheticTree& tree,
+                 CountingRuleSink& sink)
+{
+    size_t entries = tree.dirs.size() - 1 + tree.files.size();
+    size_t before = residentBytes();
+    WatchTree watches(sink);
+    RETURN_IF_ERROR(watches.addRoot(tree.root, WatchMode::PerFile));
+    size_t grown = residentBytes() - before;
+
+    report(name + " RSS", grown / 1048576.0, "MiB");
+    report(name + " RSS/entry", double(grown) / entries, "B");
+    report(name + " rules", sink.installed(), "");
+    return NO_ERROR;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto treeRes = treeFromArgs(argc, argv, { 3, 10, 100 });
+    if (treeRes.isError()) {
+        std::cerr << std::get<0>(treeRes).message << std::endl;
+        return 1;
+    }
+    const auto& tree = *std::get<1>(treeRes);
+    report("tree entries", tree.dirs.size() - 1 + tree.files.size(), "");
+
+    Result<> res = NO_ERROR;
+    {
+        CountingRuleSink sink;
+        res = measure("rules released", tree, sink);
+    }
+    if (!res.isError()) {
+        RetainingRuleSink sink;
+        res = measure("rules kept", tree, sink);
+    }
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+#include <bench.hpp>
+#include <event.hpp>
+#include <scan.hpp>
+
+#include <iostream>
+#include <libaudit.h>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string.h>
+
+namespace {
+
+// The stringstream/std::map based parser that Record::parse replaced, kept
+// here as the baseline.
+Result<std::map<std::string, std::string>> legacyParse(std::string data)
+{
+    std::map<std::string, std::string> params;
+    std::stringstream str(std::move(data));
+    char buf[20];
+    long trash;
+
+    auto expect = [&](const std::string& what) {
+        str.read(buf, what.size());
+    };
+
+    auto readUntil = [&](char end, bool allowEscape) -> std::string {
+        std::string result;
+        bool escaping = false;
+        for (char next = str.get(); !str.eof(); next = str.get()) {
+            if (allowEscape && escaping) {
+                result.push_back(next);
+                escaping = false;
+                continue;
+            }
+            if (next == end) {
+                break;
+            }
+            result.push_back(next);
+            escaping = next == '\\';
+        }
+        return result;
+    };
+
+    expect("audit(");
+    str >> trash;
+    expect(".");
+    str >> trash;
+    expect(":");
+    str >> trash;
+    expect("): ");
+
+    while (!str.eof()) {
+        auto key = readUntil('=', false);
+        if (str.eof()) {
+            if (key.empty()) {
+                break;
+            }
+            return ERROR("parse error");
+        }
+        char c = str.get();
+        std::string value;
+        if (c == '\'' || c == '"') {
+            value = readUntil(c, true);
+            str.get();
+        } else {
+            value.push_back(c);
+            value += readUntil(' ', false);
+        }
+        params.emplace(std::move(key), std::move(value));
+    }
+    return std::move(params);
+}
+
+const std::pair<ScanImpl, std::string> scanImpls[] = {
+    { ScanImpl::Scalar, "scalar" },
+    { ScanImpl::Sse2, "sse2" },
+    { ScanImpl::Avx2, "avx2" },
+};
+
+// Everything the parser produced for a record, in comparable form
+std::string describe(const Result<Record>& res)
+{
+    if (res.isError()) {
+        return "error: " + std::get<0>(res).message;
+    }
+    const auto& rec = std::get<1>(res);
+    std::stringstream str;
+    str << rec.timestamp << ":" << rec.sequenceNumber;
+    for (const auto& [key, value] : rec.params) {
+        str << "\n[" << key << "]=[" << value << "]";
+    }
+    return str.str();
+}
+
+// Checks that every scanner implementation finds the same delimiters and
+// makes the parser produce the same records as the scalar one.
+bool verifyScanners(const std::vector<SampleRecord>& sample)
+{
+    std::vector<std::string> inputs;
+    for (const auto& rec : sample) {
+        inputs.push_back(rec.message);
+    }
+    std::mt19937 rng(42);
+    const std::string alphabet = "ab=' \"\\/0";
+    for (int i = 0; i < 2000; ++i) {
+        std::string str = "audit(1.2:3): ";
+        size_t len = rng() % 300;
+        for (size_t j = 0; j < len; ++j) {
+            str.push_back(alphabet[rng() % alphabet.size()]);
+        }
+        inputs.push_back(std::move(str));
+    }
+
+    const std::pair<char, char> delims[] = {
+        { '=', '=' }, { ' ', ' ' }, { '"', '\\' }, { '\'', '\\' }
+    };
+
+    bool ok = true;
+    for (const auto& input : inputs) {
+        std::vector<size_t> expectedPositions;
+        setScanImpl(ScanImpl::Scalar);
+        for (const auto& [a, b] : delims) {
+            DelimiterScanner scanner(input);
+            for (size_t start = 0; start <= input.size(); ++start) {
+                expectedPositions.push_back(scanner.find(start, a, b));
+            }
+        }
+        auto expectedRecord = describe(Record::parse(input));
+
+        for (const auto& [impl, name] : scanImpls) {
+            if (!isScanImplSupported(impl)) {
+                continue;
+            }
+            setScanImpl(impl);
+            size_t idx = 0;
+            for (const auto& [a, b] : delims) {
+                DelimiterScanner scanner(input);
+                for (size_t start = 0; start <= input.size(); ++start) {
+                    if (scanner.find(start, a, b) != expectedPositions[idx++]) {
+                        std::cerr << name << " scan mismatch at offset "
+                                  << start << " in: " << input << std::endl;
+                        ok = false;
+                    }
+                }
+            }
+            if (describe(Record::parse(input)) != expectedRecord) {
+                std::cerr << name << " parse mismatch in: " << input
+                          << std::endl;
+                ok = false;
+            }
+        }
+    }
+    setScanImpl(bestScanImpl());
+    return ok;
+}
+
+template<class F>
+void run(const std::string& name,
+         const std::vector<SampleRecord>& sample,
+         size_t rounds,
+         F&& parse)
+{
+    size_t bytes = 0;
+    for (const auto& rec : sample) {
+        bytes += rec.message.size();
+    }
+
+    auto allocsBefore = allocationCount();
+    Stopwatch timer;
+    for (size_t i = 0; i < rounds; ++i) {
+        for (const auto& rec : sample) {
+            parse(rec);
+        }
+    }
+    double elapsed = timer.seconds();
+    double records = double(rounds) * sample.size();
+
+    report(name + " time/record", elapsed * 1e9 / records, "ns");
+    report(
+        name + " throughput", double(bytes) * rounds / elapsed / 1e6, "MB/s");
+    report(name + " allocations/record",
+           double(allocationCount() - allocsBefore) / records,
+           "");
+}
+
+// Parses the sample and assembles it into events, each round with new
+// sequence numbers and one second later. With dropEvery set, the EOE record
+// of every dropEvery-th event is left out, as if it had been lost, and the
+// incomplete events must not pile up.
+void runAssembler(const std::string& name,
+                  const std::vector<SampleRecord>& sample,
+                  size_t rounds,
+                  size_t dropEvery)
+{
+    EventAssembler assembler{ Config() };
+    size_t events = 0;
+    size_t eoe = 0;
+
+    auto allocsBefore = allocationCount();
+    Stopwatch timer;
+    for (size_t i = 0; i < rounds; ++i) {
+        for (const auto& rec : sample) {
+            auto fields = wantedFields(rec.type);
+            if (fields == nullptr) {
+                continue;
+            }
+            if (rec.type == AUDIT_EOE && dropEvery != 0 &&
+                eoe++ % dropEvery == 0) {
+                continue;
+            }
+            auto res = Record::parse(rec.message, fields);
+            if (res.isError()) {
+                continue;
+            }
+            auto& record = std::get<1>(res);
+            record.timestamp += i;
+            record.sequenceNumber += i * 1000000;
+            if (assembler.addRecord(rec.type, record)) {
+                events++;
+            }
+        }
+    }
+    double elapsed = timer.seconds();
+    double records = double(rounds) * sample.size();
+    auto stats = assembler.stats();
+
+    report(name + " time/record", elapsed * 1e9 / records, "ns");
+    report(name + " allocations/record",
+           double(allocationCount() - allocsBefore) / records,
+           "");
+    report(name + " events", events, "");
+    report(name + " pending", stats.pending, "");
+    report(name + " timed out", stats.timedOut, "");
+    report(name + " evicted", stats.evicted, "");
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto sampleRes = loadSample("sample.log");
+    if (sampleRes.isError()) {
+        std::cerr << std::get<0>(sampleRes).message << std::endl;
+        return 1;
+    }
+    const auto& sample = std::get<1>(sampleRes);
+    size_t rounds = argc > 1 ? std::stoul(argv[1]) : 20000;
+
+    run("legacy", sample, rounds, [](const SampleRecord& rec) {
+        auto res = legacyParse(rec.message);
+        keep(res);
+    });
+    if (!verifyScanners(sample)) {
+        return 1;
+    }
+
+    for (const auto& [impl, name] : scanImpls) {
+        if (!isScanImplSupported(impl)) {
+            continue;
+        }
+        setScanImpl(impl);
+        run("Record::parse " + name,
+            sample,
+            rounds,
+            [](const SampleRecord& rec) {
+                auto res = Record::parse(rec.message);
+                keep(res);
+            });
+    }
+    setScanImpl(bestScanImpl());
+
+    run("Record::parse (wanted fields)",
+        sample,
+        rounds,
+        [](const SampleRecord& rec) {
+            auto fields = wantedFields(rec.type);
+            if (fields == nullptr) {
+                return;
+            }
+            auto res = Record::parse(rec.message, fields);
+            keep(res);
+        });
+
+    runAssembler("EventAssembler", sample, rounds, 0);
+    runAssembler("EventAssembler (lost EOE)", sample, rounds, 4);
+    return 0;
+}
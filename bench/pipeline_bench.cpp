@@ -0,0 +1,240 @@
+#include <bench.hpp>
+#include <loop.hpp>
+#include <pipeline.hpp>
+#include <source.hpp>
+
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+// Pushes audit records through the whole pipeline (parser threads, event
+// assembly, the writer thread and the log) as fast as it takes them, and
+// reports throughput, how long events spend in each stage and heap
+// allocations per event. Rules are counted, not installed, so no root is
+// needed.
+//
+// By default, read events on the files of a generated tree are fed in twice:
+// from memory, already split into records like the netlink socket delivers
+// them in standalone mode, and as text through a pipe, like auditd sends them
+// to the plugin. --replay plays back a recording made with the recordPath
+// option from memory instead (the watched paths of the recording don't exist
+// here, so the writer mostly drops those events).
+//
+// usage: pipeline_bench [rounds]
+//        pipeline_bench --replay FILE [rounds]
+
+namespace {
+
+// distinct events in one round of the synthetic stream
+constexpr size_t syntheticEvents = 10000;
+
+std::string syntheticRecords(const SyntheticTree& tree)
+{
+    std::string data;
+    for (size_t i = 0; i < syntheticEvents; ++i) {
+        const auto& path = tree.files[i % tree.files.size()];
+        auto header = "msg=audit(1700000000." + std::to_string(i % 1000) +
+                      ":" + std::to_string(i + 1) + "): ";
+        data += "type=SYSCALL " + header +
+                "arch=c000003e syscall=257 success=yes exit=3 a0=ffffff9c "
+                "a1=7ffc3a6b1f2e a2=0 a3=0 items=1 ppid=2211 pid=2304 "
+                "auid=1000 uid=1000 gid=1000 euid=1000 suid=1000 "
+                "fsuid=1000 egid=1000 sgid=1000 fsgid=1000 tty=pts0 ses=3 "
+                "comm=\"cat\" exe=\"/usr/bin/cat\" subj=unconfined "
+                "key=\"r1\"\n";
+        data += "type=CWD " + header + "cwd=\"/root\"\n";
+        data += "type=PATH " + header + "item=0 name=\"" + path +
+                "\" inode=1311785 dev=08:01 mode=0100644 ouid=1000 "
+                "ogid=1000 rdev=00:00 nametype=NORMAL cap_fp=0 cap_fi=0 "
+                "cap_fe=0 cap_fver=0 cap_frootid=0\n";
+        data += "type=PROCTITLE " + header + "proctitle=63617400\n";
+        data += "type=EOE " + header + "\n";
+    }
+    return data;
+}
+
+void reportLatency(const std::string& name, std::vector<double>& micros)
+{
+    if (micros.empty()) {
+        return;
+    }
+    std::sort(micros.begin(), micros.end());
+    const std::pair<double, const char*> percentiles[] = {
+        { 0.5, "p50" }, { 0.9, "p90" }, { 0.99, "p99" }, { 0.999, "p99.9" }
+    };
+    for (const auto& [fraction, label] : percentiles) {
+        report(name + " " + label,
+               micros[size_t(fraction * (micros.size() - 1))],
+               "us");
+    }
+    report(name + " max", micros.back(), "us");
+}
+
+double micros(EventTiming::Clock::time_point from,
+              EventTiming::Clock::time_point to)
+{
+    return std::chrono::duration<double, std::micro>(to - from).count();
+}
+
+// Reads everything from source the way main does. Sources that can't be
+// polled are drained at once.
+Result<> readAll(Pipeline& pipeline, EventSource& source)
+{
+    if (source.getFd() < 0) {
+        return pipeline.readRecords();
+    }
+    auto stream = dynamic_cast<StreamSource*>(&source);
+    RETURN_OR_SET(auto loop, EventLoop::create());
+    RETURN_IF_ERROR(loop->watchFd(source.getFd(), [&]() -> Result<> {
+        RETURN_IF_ERROR(pipeline.readRecords());
+        if (stream != nullptr && stream->isClosed()) {
+            loop->stop();
+        }
+        return Result<>(NO_ERROR);
+    }));
+    return loop->run();
+}
+
+Result<> run(const std::string& name,
+             std::shared_ptr<EventSource> source,
+             const Config& config,
+             size_t expectedEvents)
+{
+    RETURN_OR_SET(auto handler,
+                  EventHandler::create(std::make_unique<CountingRuleSink>(),
+                                       config));
+
+    std::vector<double> parse, write, total;
+    parse.reserve(expectedEvents);
+    write.reserve(expectedEvents);
+    total.reserve(expectedEvents);
+    auto observer = [&](const Event& event) {
+        const auto& timing = event.getTiming();
+        parse.push_back(micros(timing.read, timing.assembled));
+        write.push_back(micros(timing.assembled, timing.processed));
+        total.push_back(micros(timing.read, timing.processed));
+    };
+    RETURN_OR_SET(auto pipeline,
+                  Pipeline::create(source, handler, config, observer));
+
+    // the reader echoes every record to stdout
+    std::cout.flush();
+    int savedStdout = dup(1);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 1);
+    close(devNull);
+
+    auto allocsBefore = allocationCount();
+    Stopwatch timer;
+    auto res = readAll(*pipeline, *source);
+    // drains the queues
+    pipeline.reset();
+    double elapsed = timer.seconds();
+    size_t allocs = allocationCount() - allocsBefore;
+
+    std::cout.flush();
+    dup2(savedStdout, 1);
+    close(savedStdout);
+    RETURN_IF_ERROR(res);
+
+    double events = total.size();
+    report(name + " events", events, "");
+    report(name + " throughput", events / elapsed, "events/s");
+    report(name + " allocations/event", allocs / std::max(events, 1.0), "");
+    reportLatency(name + " parse+assemble", parse);
+    reportLatency(name + " queue+write", write);
+    reportLatency(name + " end to end", total);
+    return NO_ERROR;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    char outputPath[] = "/tmp/dirwatch-bench-log-XXXXXX";
+    int outputFd = mkstemp(outputPath);
+    if (outputFd < 0) {
+        std::cerr << "can't create output file" << std::endl;
+        return 1;
+    }
+    close(outputFd);
+    ScopeGuard removeOutput([&]() { unlink(outputPath); });
+
+    Config config;
+    config.outputPath = outputPath;
+
+    if (argc > 2 && std::string(argv[1]) == "--replay") {
+        size_t rounds = argc > 3 ? std::stoul(argv[3]) : 1;
+        auto sourceRes = ReplaySource::load(argv[2], rounds);
+        if (sourceRes.isError()) {
+            std::cerr << std::get<0>(sourceRes).message << std::endl;
+            return 1;
+        }
+        auto res = run("replay", std::move(std::get<1>(sourceRes)), config, 0);
+        if (res.isError()) {
+            std::cerr << std::get<0>(res).message << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    size_t rounds = argc > 1 ? std::stoul(argv[1]) : 20;
+    auto treeRes = SyntheticTree::create({ 1, 10, 100 });
+    if (treeRes.isError()) {
+        std::cerr << std::get<0>(treeRes).message << std::endl;
+        return 1;
+    }
+    const auto& tree = *std::get<1>(treeRes);
+    config.paths.emplace(tree.root, WatchMode::PerFile);
+    auto records = syntheticRecords(tree);
+    size_t expectedEvents = syntheticEvents * rounds;
+
+    auto res = run("memory",
+                   std::make_shared<ReplaySource>(records, rounds),
+                   config,
+                   expectedEvents);
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0) {
+        std::cerr << "can't create pipe" << std::endl;
+        return 1;
+    }
+    // before the writer starts, so that failing here leaves nothing to join
+    auto streamRes = StreamSource::create(fds[0]);
+    if (streamRes.isError()) {
+        std::cerr << std::get<0>(streamRes).message << std::endl;
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    // plays auditd, writing as fast as the pipe takes it
+    std::thread writer([&]() {
+        for (size_t i = 0; i < rounds; ++i) {
+            size_t written = 0;
+            while (written < records.size()) {
+                auto count = write(
+                    fds[1], records.data() + written, records.size() - written);
+                if (count < 0) {
+                    break;
+                }
+                written += count;
+            }
+        }
+        close(fds[1]);
+    });
+    res = run(
+        "stdin", std::move(std::get<1>(streamRes)), config, expectedEvents);
+    writer.join();
+    close(fds[0]);
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <bench.hpp>
+#include <treewalk.hpp>
+#include <watch.hpp>
+
+#include <iostream>
+
+// Measures how long it takes to come up on a large tree in per-file mode,
+// with different numbers of scanning threads. The default shape has about a
+// million entries. Rules go to a counting sink, so this covers the directory
+// walk and building the rules but not the kernel. The tree is in the page
+// cache after it's been generated, so this is the warm cache case.
+//
+// usage: startup_bench [depth] [fanout] [files]
+
+namespace {
+
+const size_t threadCounts[] = { 1, 2, 4, 8 };
+
+Result<> run(const SyntheticTree& tree)
+{
+    size_t entries = tree.dirs.size() - 1 + tree.files.size();
+    report("tree entries", entries, "");
+
+    for (auto threads : threadCounts) {
+        auto name = std::to_string(threads) + " thread(s)";
+        {
+            size_t found = 0;
+            Stopwatch timer;
+            RETURN_IF_ERROR(
+                walkTree(tree.root, threads, [&](const TreeEntry&) -> Result<> {
+                    found++;
+                    return NO_ERROR;
+                }));
+            report(name + " walk", timer.seconds() * 1e3, "ms");
+            if (found != entries) {
+                return ERROR("walk found " + std::to_string(found) +
+                             " entries instead of " + std::to_string(entries));
+            }
+        }
+
+        CountingRuleSink sink;
+        Stopwatch timer;
+        WatchTree watches(sink, threads);
+        RETURN_IF_ERROR(watches.addRoot(tree.root, WatchMode::PerFile));
+        double seconds = timer.seconds();
+        report(name + " startup", seconds * 1e3, "ms");
+        report(name + " startup", entries / seconds, "entries/s");
+
+        if (threads == threadCounts[0]) {
+            auto usage = watches.memoryUsage();
+            report("tree bytes/node", double(usage.bytes) / usage.nodes, "B");
+        }
+    }
+    return NO_ERROR;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Stopwatch timer;
+    auto treeRes = treeFromArgs(argc, argv, { 3, 10, 900 });
+    if (treeRes.isError()) {
+        std::cerr << std::get<0>(treeRes).message << std::endl;
+        return 1;
+    }
+    report("tree generation", timer.seconds(), "s");
+
+    auto res = run(*std::get<1>(treeRes));
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
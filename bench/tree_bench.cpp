@@ -0,0 +1,126 @@
+#include <bench.hpp>
+#include <watch.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+// How the watch tree scales with the size of the watched tree in per-file
+// mode: building it, its memory, looking up paths and following entries as
+// they are created and deleted. Rules go to a counting sink and the tree is
+// walked with a single thread, so this is the cost of dirwatch itself.
+//
+// Churn deletes an entry from the watch tree and creates it again; the files
+// stay on disk, so file system time is limited to the stat() and, for
+// directories, reading them again.
+//
+// usage: tree_bench [depth] [fanout] [files]
+
+namespace {
+
+// upper bound for the number of entries each churn run goes through
+constexpr size_t churnSamples = 100000;
+
+Result<> churn(WatchTree& watches, const std::string& path)
+{
+    RETURN_IF_ERROR(watches.unwatchPath(watches.locate(path)));
+    auto loc = watches.locate(path);
+    if (loc.rest.empty()) {
+        return ERROR("still watched after deletion: " + path);
+    }
+    return watches.watchPath(loc, path);
+}
+
+Result<> run(const SyntheticTree& tree)
+{
+    const auto& shape = tree.shape;
+    size_t entries = tree.dirs.size() - 1 + tree.files.size();
+    report("tree entries", entries, "");
+
+    CountingRuleSink sink;
+    size_t before = residentBytes();
+    Stopwatch buildTimer;
+    WatchTree watches(sink, 1);
+    RETURN_IF_ERROR(watches.addRoot(tree.root, WatchMode::PerFile));
+    double buildSeconds = buildTimer.seconds();
+    size_t grown = residentBytes() - before;
+    auto usage = watches.memoryUsage();
+    size_t rules = sink.installed();
+
+    report("build", buildSeconds * 1e3, "ms");
+    report("build", entries / buildSeconds, "entries/s");
+    report("RSS growth/entry", double(grown) / entries, "B");
+    report("tree bytes/entry", double(usage.bytes) / entries, "B");
+    report("rules", rules, "");
+
+    std::mt19937 rng(42);
+    std::vector<std::string> files = tree.files;
+    std::shuffle(files.begin(), files.end(), rng);
+    files.resize(std::min(files.size(), churnSamples));
+
+    Stopwatch locateTimer;
+    for (const auto& path : files) {
+        auto loc = watches.locate(path);
+        if (!loc.rest.empty()) {
+            return ERROR("not in the watch tree: " + path);
+        }
+        keep(loc);
+    }
+    report("locate", locateTimer.seconds() * 1e9 / files.size(), "ns");
+
+    Stopwatch fileTimer;
+    for (const auto& path : files) {
+        RETURN_IF_ERROR(churn(watches, path));
+    }
+    report("file delete+create", files.size() / fileTimer.seconds(), "/s");
+
+    // the deepest directories hold only files
+    size_t rootDepth = std::count(tree.root.begin(), tree.root.end(), '/');
+    std::vector<std::string> leaves;
+    for (const auto& dir : tree.dirs) {
+        if (size_t(std::count(dir.begin(), dir.end(), '/')) ==
+                rootDepth + shape.depth &&
+            dir != tree.root) {
+            leaves.push_back(dir);
+        }
+    }
+    std::shuffle(leaves.begin(), leaves.end(), rng);
+    leaves.resize(std::min(leaves.size(), churnSamples / (shape.files + 1)));
+    if (!leaves.empty()) {
+        Stopwatch dirTimer;
+        for (const auto& path : leaves) {
+            RETURN_IF_ERROR(churn(watches, path));
+        }
+        double seconds = dirTimer.seconds();
+        report("directory delete+create", leaves.size() / seconds, "/s");
+        report("directory delete+create",
+               leaves.size() * (shape.files + 1) / seconds,
+               "entries/s");
+    }
+
+    if (sink.installed() != rules) {
+        return ERROR("churn changed the number of rules from " +
+                     std::to_string(rules) + " to " +
+                     std::to_string(sink.installed()));
+    }
+    report("peak RSS", peakResidentBytes() / 1048576.0, "MiB");
+    return NO_ERROR;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    auto treeRes = treeFromArgs(argc, argv, { 3, 10, 100 });
+    if (treeRes.isError()) {
+        std::cerr << std::get<0>(treeRes).message << std::endl;
+        return 1;
+    }
+
+    auto res = run(*std::get<1>(treeRes));
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <bench.hpp>
+#include <watch.hpp>
+
+#include <fcntl.h>
+#include <iostream>
+#include <libaudit.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <tuple>
+#include <unistd.h>
+
+// Compares the per-file and the directory watch modes on a generated tree:
+// how many rules each installs, how long the initial setup takes, and, with
+// --kernel (needs root), how much the installed rules slow down syscalls of
+// other processes, with rules on all syscalls and with scoped ones.
+//
+// usage: watch_mode_bench [--kernel] [depth] [fanout] [files]
+
+namespace {
+
+const std::pair<WatchMode, std::string> watchModes[] = {
+    { WatchMode::PerFile, "per-file" },
+    { WatchMode::Directory, "directory" },
+};
+
+const std::pair<RuleSyscalls, std::string> ruleScopes[] = {
+    { RuleSyscalls::All, "all syscalls" },
+    { RuleSyscalls::Scoped, "scoped" },
+};
+
+// Time per call of the syscalls of a synthetic workload
+struct SyscallTimes
+{
+    double statInside;
+    double statOutside;
+    double openOutside;
+    double getppid;
+};
+
+// stat()s every file in the tree, then runs the same number of stat()s and
+// open()s outside it and of a syscall that has nothing to do with files.
+// Exit filter rules are considered for every syscall, so all are affected.
+SyscallTimes measureSyscalls(const SyntheticTree& tree, size_t rounds)
+{
+    struct stat st;
+    size_t calls = rounds * tree.files.size();
+    SyscallTimes times;
+
+    Stopwatch inside;
+    for (size_t i = 0; i < rounds; ++i) {
+        for (const auto& file : tree.files) {
+            keep(stat(file.c_str(), &st));
+        }
+    }
+    times.statInside = inside.seconds() / double(calls) * 1e9;
+
+    Stopwatch outside;
+    for (size_t i = 0; i < calls; ++i) {
+        keep(stat("/", &st));
+    }
+    times.statOutside = outside.seconds() / double(calls) * 1e9;
+
+    Stopwatch open;
+    for (size_t i = 0; i < calls; ++i) {
+        int fd = ::open("/dev/null", O_RDONLY);
+        keep(fd);
+        close(fd);
+    }
+    times.openOutside = open.seconds() / double(calls) * 1e9;
+
+    Stopwatch other;
+    for (size_t i = 0; i < calls; ++i) {
+        keep(syscall(SYS_getppid));
+    }
+    times.getppid = other.seconds() / double(calls) * 1e9;
+    return times;
+}
+
+// reports the times, and how much slower they are than without rules
+void reportSyscalls(const std::string& name,
+                    const SyscallTimes& times,
+                    const SyscallTimes* baseline)
+{
+    const std::tuple<std::string, double SyscallTimes::*> calls[] = {
+        { "stat() in tree", &SyscallTimes::statInside },
+        { "stat() elsewhere", &SyscallTimes::statOutside },
+        { "open()+close() elsewhere", &SyscallTimes::openOutside },
+        { "getppid()", &SyscallTimes::getppid },
+    };
+    for (const auto& [call, member] : calls) {
+        report(name + " " + call, times.*member, "ns");
+        if (baseline != nullptr) {
+            report(name + " " + call + " slowdown",
+                   (times.*member / baseline->*member - 1) * 100,
+                   "%");
+        }
+    }
+}
+
+Result<> run(const SyntheticTree& tree, bool kernel)
+{
+    report("tree directories", tree.dirs.size(), "");
+    report("tree files", tree.files.size(), "");
+
+    int auditFd = -1;
+    SyscallTimes baseline;
+    if (kernel) {
+        auditFd = audit_open();
+        if (auditFd < 0) {
+            return ERROR("can't open audit socket");
+        }
+        RETURN_IF_C_ERROR(audit_set_enabled(auditFd, 1));
+        // the first run only warms up the caches
+        measureSyscalls(tree, 5);
+        baseline = measureSyscalls(tree, 20);
+        reportSyscalls("no rules", baseline, nullptr);
+    }
+    ScopeGuard closeAudit([&]() {
+        if (auditFd >= 0) {
+            audit_close(auditFd);
+        }
+    });
+    ScopeGuard resetScope([]() { setRuleSyscalls(RuleSyscalls::Scoped); });
+
+    for (const auto& [mode, name] : watchModes) {
+        CountingRuleSink counter;
+        {
+            Stopwatch timer;
+            WatchTree watches(counter);
+            RETURN_IF_ERROR(watches.addRoot(tree.root, mode));
+            report(name + " setup", timer.seconds() * 1e3, "ms");
+        }
+        report(name + " rules", counter.added, "");
+
+        if (!kernel) {
+            continue;
+        }
+        for (const auto& [scope, scopeName] : ruleScopes) {
+            setRuleSyscalls(scope);
+            AuditRuleSink sink(auditFd);
+            Stopwatch timer;
+            WatchTree watches(sink);
+            RETURN_IF_ERROR(watches.addRoot(tree.root, mode));
+            report(name + ", " + scopeName + " setup (kernel)",
+                   timer.seconds() * 1e3,
+                   "ms");
+            reportSyscalls(
+                name + ", " + scopeName, measureSyscalls(tree, 20), &baseline);
+        }
+    }
+    return NO_ERROR;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bool kernel = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--kernel") == 0) {
+            kernel = true;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            std::cerr << "unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (kernel && geteuid() != 0) {
+        std::cerr << "--kernel needs root" << std::endl;
+        return 1;
+    }
+
+    auto treeRes = treeFromArgs(argc, argv, { 3, 4, 8 });
+    if (treeRes.isError()) {
+        std::cerr << std::get<0>(treeRes).message << std::endl;
+        return 1;
+    }
+    auto res = run(*std::get<1>(treeRes), kernel);
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
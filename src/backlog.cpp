@@ -0,0 +1,112 @@
+#include <backlog.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+#include <libaudit.h>
+
+#include <metrics.hpp>
+
+namespace {
+
+// polls in a row that shedding starts and stops after
+constexpr unsigned overloadPolls = 3;
+constexpr unsigned recoveryPolls = 10;
+
+size_t totalStalls(const Pipeline& pipeline)
+{
+    size_t total = 0;
+    for (const auto& stage : pipeline.queueStats()) {
+        total += stage.stalls;
+    }
+    return total;
+}
+
+}
+
+BacklogControl::BacklogControl(int statusFd, const Config& config)
+    : statusFd(statusFd)
+    , limit(config.backlogLimit)
+    , maxLimit(config.backlogLimitMax)
+    , shedReads(config.shedReads)
+    , lost(0)
+    , stalls(0)
+    , overloadedPolls(0)
+    , calmPolls(0)
+{}
+
+Result<std::unique_ptr<BacklogControl>> BacklogControl::create(
+    int statusFd,
+    const Config& config)
+{
+    auto res =
+        std::unique_ptr<BacklogControl>(new BacklogControl(statusFd, config));
+    if (statusFd < 0) {
+        return std::move(res);
+    }
+    RETURN_IF_C_ERROR(audit_set_backlog_limit(statusFd, res->limit));
+    RETURN_IF_C_ERROR(
+        audit_set_backlog_wait_time(statusFd, config.backlogWaitTime));
+    RETURN_IF_C_ERROR(audit_set_rate_limit(statusFd, config.rateLimit));
+    // only records lost from now on count
+    RETURN_OR_SET(auto status, requestAuditStatus(statusFd));
+    res->lost = status.lost;
+    return std::move(res);
+}
+
+Result<bool> BacklogControl::grow()
+{
+    if (this->limit >= this->maxLimit) {
+        return false;
+    }
+    uint32_t limit = uint32_t(std::min<uint64_t>(
+        uint64_t(this->limit) * 2, this->maxLimit));
+    RETURN_IF_C_ERROR(audit_set_backlog_limit(this->statusFd, limit));
+    this->limit = limit;
+    LOG << "audit backlog limit raised to " << limit << std::endl;
+    return true;
+}
+
+Result<> BacklogControl::update(Pipeline& pipeline)
+{
+    size_t stalls = totalStalls(pipeline);
+    bool overloaded = stalls != this->stalls;
+    this->stalls = stalls;
+
+    if (this->statusFd >= 0) {
+        RETURN_OR_SET(auto status, requestAuditStatus(this->statusFd));
+        uint32_t lost = status.lost - this->lost;
+        this->lost = status.lost;
+        if (lost > 0) {
+            LOG << "kernel lost " << lost << " audit records" << std::endl;
+        }
+        bool filling = uint64_t(status.backlog) * 2 > status.backlog_limit;
+        if (filling || lost > 0) {
+            RETURN_OR_SET(bool grown, this->grow());
+            overloaded = overloaded || !grown;
+        }
+    }
+
+    if (!this->shedReads) {
+        return NO_ERROR;
+    }
+    if (overloaded) {
+        this->calmPolls = 0;
+        if (++this->overloadedPolls >= overloadPolls &&
+            !pipeline.shedsReads()) {
+            LOG << "can't keep up with the audit records, dropping read "
+                   "events"
+                << std::endl;
+            pipeline.setShedReads(true);
+        }
+    } else {
+        this->overloadedPolls = 0;
+        if (++this->calmPolls >= recoveryPolls && pipeline.shedsReads()) {
+            LOG << "caught up, logging read events again after dropping "
+                << pipeline.shedCount() << " in total" << std::endl;
+            pipeline.setShedReads(false);
+        }
+    }
+    return NO_ERROR;
+}
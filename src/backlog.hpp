@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <config.hpp>
+#include <pipeline.hpp>
+#include <util.hpp>
+
+// Keeps the kernel's audit queue and dirwatch's own load in check, polled
+// from a timer.
+//
+// When the kernel's queue is full, a process generating an audit record waits
+// up to backlogWaitTime for room, and the record is lost after that. Instead
+// of leaving the limit at the kernel's default, it starts at backlogLimit and
+// is doubled, up to backlogLimitMax, whenever the queue gets more than half
+// full or records are lost. A bigger queue only absorbs bursts though. If
+// the queue still fills up at its largest, or the pipeline's queues back up,
+// for a few seconds in a row, dirwatch can't keep up, and with shedReads it
+// drops read events until things have been quiet for a while. Writes,
+// creates and deletes are still logged meanwhile.
+//
+// As an auditd plugin, the kernel settings are auditd's; only the pipeline
+// is watched then.
+class BacklogControl
+{
+    // audit socket for status requests, -1 as a plugin
+    int statusFd;
+    uint32_t limit;
+    uint32_t maxLimit;
+    bool shedReads;
+    // kernel's lost counter and the pipeline's stalls at the last poll
+    uint32_t lost;
+    size_t stalls;
+    // polls in a row with and without signs of overload
+    unsigned overloadedPolls;
+    unsigned calmPolls;
+
+    BacklogControl(int statusFd, const Config& config);
+
+    // Doubles the kernel's backlog limit, if it isn't at its maximum yet.
+    // Returns false if it is.
+    Result<bool> grow();
+
+public:
+    // Applies the backlog limit, wait time and rate limit through statusFd,
+    // unless it is -1.
+    static Result<std::unique_ptr<BacklogControl>> create(int statusFd,
+                                                          const Config& config);
+
+    // Checks the kernel's status and the pipeline's queues, growing the
+    // kernel's queue and turning shedding on or off as needed.
+    Result<> update(Pipeline& pipeline);
+};
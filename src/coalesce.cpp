@@ -0,0 +1,136 @@
+#include <coalesce.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <time.h>
+
+namespace {
+
+constexpr uint32_t none = UINT32_MAX;
+
+size_t hashOf(std::string_view path,
+              AccessType access,
+              std::string_view pid,
+              std::string_view uid)
+{
+    std::hash<std::string_view> hash;
+    size_t res = hash(path);
+    res = mixHash(res ^ hash(pid)) + size_t(access);
+    return mixHash(res ^ hash(uid));
+}
+
+}
+
+CoalescingLog::CoalescingLog(std::unique_ptr<EventLog> inner,
+                             long windowSec,
+                             size_t capacity)
+    : inner(std::move(inner))
+    , window(windowSec)
+    , slots(std::max<size_t>(capacity, 1))
+    , oldest(none)
+    , newest(none)
+{
+    for (size_t i = this->slots.size(); i > 0; --i) {
+        this->freeSlots.push_back(i - 1);
+    }
+}
+
+CoalescingLog::~CoalescingLog()
+{
+    while (this->oldest != none) {
+        if (auto res = this->emitOldest(); res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
+        }
+    }
+}
+
+Result<> CoalescingLog::emitOldest()
+{
+    uint32_t id = this->oldest;
+    auto& slot = this->slots[id];
+    auto res = this->inner->append({ slot.first,
+                                     slot.path,
+                                     slot.access,
+                                     slot.pid,
+                                     slot.uid,
+                                     slot.userName,
+                                     slot.comm,
+                                     slot.count,
+                                     slot.last });
+
+    this->oldest = slot.newer;
+    if (this->oldest == none) {
+        this->newest = none;
+    }
+    this->index.erase(id, [this](uint32_t i) { return this->slots[i].hash; });
+    this->freeSlots.push_back(id);
+    return res;
+}
+
+Result<> CoalescingLog::emitExpired(long now)
+{
+    while (this->oldest != none &&
+           this->slots[this->oldest].first + this->window <= now) {
+        RETURN_IF_ERROR(this->emitOldest());
+    }
+    return NO_ERROR;
+}
+
+Result<> CoalescingLog::append(const LogEntry& entry)
+{
+    RETURN_IF_ERROR(this->emitExpired(entry.timestamp));
+
+    size_t hash = hashOf(entry.path, entry.access, entry.pid, entry.uid);
+    auto found = this->index.find(hash, [&](uint32_t id) {
+        const auto& slot = this->slots[id];
+        return slot.hash == hash && slot.access == entry.access &&
+               slot.path == entry.path && slot.pid == entry.pid &&
+               slot.uid == entry.uid;
+    });
+    if (found) {
+        auto& slot = this->slots[*found];
+        slot.count++;
+        slot.last = std::max(slot.last, entry.timestamp);
+        return NO_ERROR;
+    }
+
+    if (this->freeSlots.empty()) {
+        RETURN_IF_ERROR(this->emitOldest());
+    }
+    uint32_t id = this->freeSlots.back();
+    this->freeSlots.pop_back();
+    auto& slot = this->slots[id];
+    // assign() keeps the capacity of the slot's strings
+    slot.path.assign(entry.path);
+    slot.pid.assign(entry.pid);
+    slot.uid.assign(entry.uid);
+    slot.userName.assign(entry.userName);
+    slot.comm.assign(entry.comm);
+    slot.access = entry.access;
+    slot.first = entry.timestamp;
+    slot.last = entry.timestamp;
+    slot.count = 1;
+    slot.hash = hash;
+    slot.newer = none;
+    if (this->newest == none) {
+        this->oldest = id;
+    } else {
+        this->slots[this->newest].newer = id;
+    }
+    this->newest = id;
+    this->index.insert(id, [this](uint32_t i) { return this->slots[i].hash; });
+    return NO_ERROR;
+}
+
+Result<> CoalescingLog::flush()
+{
+    RETURN_IF_ERROR(this->emitExpired(time(nullptr)));
+    return this->inner->flush();
+}
+
+Result<> CoalescingLog::sync()
+{
+    RETURN_IF_ERROR(this->emitExpired(time(nullptr)));
+    return this->inner->sync();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <eventlog.hpp>
+#include <idindex.hpp>
+#include <util.hpp>
+
+// Merges accesses with the same path, access type, pid and uid within a time
+// window into a single entry, with the number of accesses and the time of
+// the last one. Pending entries are kept in a fixed-size hash table, in order
+// of their first access; they are written to the log they wrap once their
+// window has passed, or early, oldest first, when the table is full.
+class CoalescingLog : public EventLog
+{
+    struct Slot
+    {
+        std::string path;
+        std::string pid;
+        std::string uid;
+        std::string userName;
+        std::string comm;
+        AccessType access;
+        long first;
+        long last;
+        uint32_t count;
+        size_t hash;
+        // next entry in order of first access
+        uint32_t newer;
+    };
+
+    std::unique_ptr<EventLog> inner;
+    long window;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    IdIndex index;
+    uint32_t oldest;
+    uint32_t newest;
+
+    // writes out and removes the oldest entry
+    Result<> emitOldest();
+    Result<> emitExpired(long now);
+
+public:
+    CoalescingLog(std::unique_ptr<EventLog> inner,
+                  long windowSec,
+                  size_t capacity);
+
+    // writes out every pending entry
+    ~CoalescingLog();
+
+    Result<> append(const LogEntry& entry) override;
+
+    // writes out the entries whose window has passed by the wall clock, then
+    // flushes the wrapped log
+    Result<> flush() override;
+    Result<> sync() override;
+
+    size_t pending() const { return this->index.size(); }
+};
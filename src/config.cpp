@@ -2,6 +2,70 @@
 #include <fstream>
 #include <nlohmann/json.hpp>
 
+namespace {
+Result<> readOptional(const nlohmann::json& json,
+                      const std::string& key,
+                      size_t& value)
+{
+    if (!json.contains(key)) {
+        return NO_ERROR;
+    }
+    if (!json[key].is_number_unsigned()) {
+        return ERROR(key + " not a non-negative integer");
+    }
+    value = json[key].get<size_t>();
+    return NO_ERROR;
+}
+
+Result<> readOptional(const nlohmann::json& json,
+                      const std::string& key,
+                      bool& value)
+{
+    if (!json.contains(key)) {
+        return NO_ERROR;
+    }
+    if (!json[key].is_boolean()) {
+        return ERROR(key + " not a boolean");
+    }
+    value = json[key].get<bool>();
+    return NO_ERROR;
+}
+
+Result<> readOptional(const nlohmann::json& json,
+                      const std::string& key,
+                      std::string& value)
+{
+    if (!json.contains(key)) {
+        return NO_ERROR;
+    }
+    if (!json[key].is_string()) {
+        return ERROR(key + " not a string");
+    }
+    value = json[key].get<std::string>();
+    return NO_ERROR;
+}
+
+template<class T>
+Result<> readOptional(const nlohmann::json& json,
+                      const std::string& key,
+                      std::vector<T>& values)
+{
+    if (!json.contains(key)) {
+        return NO_ERROR;
+    }
+    if (!json[key].is_array()) {
+        return ERROR(key + " not an array");
+    }
+    nlohmann::json item;
+    for (size_t i = 0; i < json[key].size(); ++i) {
+        item[key] = json[key][i];
+        values.emplace_back();
+        RETURN_IF_ERROR(readOptional(item, key, values.back()));
+    }
+    return NO_ERROR;
+}
+}
+
 Result<Config> readConfig()
 {
     std::ifstream input(CONFIG_FILE_PATH);
@@ -26,8 +90,86 @@ Result<Config> readConfig()
             if (!item["path"].is_string()) {
                 return ERROR("path missing or not a string");
             }
-            res.paths.insert(item["path"].get<std::string>());
+            auto mode = WatchMode::PerFile;
+            if (item.contains("mode")) {
+                if (item["mode"] == "directory") {
+                    mode = WatchMode::Directory;
+                } else if (item["mode"] != "file") {
+                    return ERROR("mode must be \"file\" or \"directory\"");
+                }
+            }
+            res.paths.emplace(item["path"].get<std::string>(), mode);
+        }
+
+        if (json.contains("logFormat")) {
+            if (json["logFormat"] == "binary") {
+                res.logFormat = LogFormat::Binary;
+            } else if (json["logFormat"] != "text") {
+                return ERROR("logFormat must be \"text\" or \"binary\"");
+            }
+        }
+
+        RETURN_IF_ERROR(readOptional(json, "recordPath", res.recordPath));
+        RETURN_IF_ERROR(
+            readOptional(json, "metricsSocket", res.metricsSocket));
+        RETURN_IF_ERROR(readOptional(json, "scanThreads", res.scanThreads));
+        RETURN_IF_ERROR(readOptional(json, "parserThreads", res.parserThreads));
+        RETURN_IF_ERROR(readOptional(json, "queueCapacity", res.queueCapacity));
+        RETURN_IF_ERROR(readOptional(json, "pendingEvents", res.pendingEvents));
+        if (res.pendingEvents == 0) {
+            return ERROR("pendingEvents must be positive");
+        }
+        RETURN_IF_ERROR(
+            readOptional(json, "pendingTimeoutSec", res.pendingTimeoutSec));
+        RETURN_IF_ERROR(readOptional(json, "flushBytes", res.flushBytes));
+        RETURN_IF_ERROR(
+            readOptional(json, "flushIntervalMs", res.flushIntervalMs));
+        if (res.flushIntervalMs == 0) {
+            return ERROR("flushIntervalMs must be positive");
+        }
+        RETURN_IF_ERROR(
+            readOptional(json, "syncIntervalMs", res.syncIntervalMs));
+        RETURN_IF_ERROR(readOptional(json, "rotateBytes", res.rotateBytes));
+        RETURN_IF_ERROR(
+            readOptional(json, "rotateIntervalSec", res.rotateIntervalSec));
+        RETURN_IF_ERROR(readOptional(json, "rotateName", res.rotateName));
+        if (res.rotateName.empty()) {
+            return ERROR("rotateName must not be empty");
+        }
+        RETURN_IF_ERROR(readOptional(json, "keepSegments", res.keepSegments));
+        RETURN_IF_ERROR(readOptional(json, "compress", res.compress));
+        RETURN_IF_ERROR(
+            readOptional(json, "coalesceWindowSec", res.coalesceWindowSec));
+        RETURN_IF_ERROR(
+            readOptional(json, "coalesceEntries", res.coalesceEntries));
+        if (res.coalesceEntries == 0) {
+            return ERROR("coalesceEntries must be positive");
+        }
+        RETURN_IF_ERROR(readOptional(json, "excludeUids", res.excludeUids));
+        RETURN_IF_ERROR(readOptional(json, "excludeAuids", res.excludeAuids));
+        RETURN_IF_ERROR(readOptional(json, "excludeExes", res.excludeExes));
+        RETURN_IF_ERROR(readOptional(json, "excludePaths", res.excludePaths));
+        RETURN_IF_ERROR(readOptional(json, "backlogLimit", res.backlogLimit));
+        RETURN_IF_ERROR(
+            readOptional(json, "backlogLimitMax", res.backlogLimitMax));
+        if (res.backlogLimit == 0 || res.backlogLimitMax < res.backlogLimit ||
+            res.backlogLimitMax > UINT32_MAX) {
+            return ERROR("backlogLimit must be positive and at most "
+                         "backlogLimitMax");
+        }
+        RETURN_IF_ERROR(
+            readOptional(json, "backlogWaitTime", res.backlogWaitTime));
+        RETURN_IF_ERROR(readOptional(json, "rateLimit", res.rateLimit));
+        if (res.backlogWaitTime > UINT32_MAX || res.rateLimit > UINT32_MAX) {
+            return ERROR("backlogWaitTime and rateLimit must fit in 32 bits");
+        }
+        RETURN_IF_ERROR(readOptional(json, "shedReads", res.shedReads));
+        RETURN_IF_ERROR(readOptional(json, "userCacheSize", res.userCacheSize));
+        if (res.userCacheSize == 0) {
+            return ERROR("userCacheSize must be positive");
         }
+        RETURN_IF_ERROR(
+            readOptional(json, "userCacheTtlSec", res.userCacheTtlSec));
     } catch (const std::invalid_argument& arg) {
         return ERROR(arg.what());
     }
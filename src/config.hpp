@@ -1,12 +1,87 @@
 #pragma once
 
-#include <set>
+#include <map>
+#include <vector>
+
 #include <util.hpp>
 
+enum class WatchMode
+{
+    // audit rules for every file and directory in the tree
+    PerFile,
+    // recursive audit rules on the root only
+    Directory
+};
+
+enum class LogFormat
+{
+    // tab separated lines
+    Text,
+    // a directory of memory mapped segments and a string dictionary
+    Binary
+};
+
 struct Config
 {
-    std::set<std::string> paths;
+    std::map<std::string, WatchMode> paths;
     std::string outputPath;
+    LogFormat logFormat = LogFormat::Text;
+    // if set, every audit record received is also appended to this file
+    std::string recordPath;
+    // if set, metrics are served on this unix socket
+    std::string metricsSocket;
+    // number of threads reading directories at startup
+    size_t scanThreads = 4;
+    // number of threads parsing audit records
+    size_t parserThreads = 2;
+    // capacity of each queue between pipeline stages
+    size_t queueCapacity = 256;
+    // events waiting for their remaining records, per parser thread
+    size_t pendingEvents = 1024;
+    // an incomplete event is dropped once records this many seconds newer
+    // arrive
+    size_t pendingTimeoutSec = 10;
+    // the log is written when this much is buffered...
+    size_t flushBytes = 1 << 20;
+    // ...or at least this often
+    size_t flushIntervalMs = 1000;
+    // fdatasync interval for the log, 0 means never
+    size_t syncIntervalMs = 0;
+    // the text log is rotated once its file is this large...
+    size_t rotateBytes = 0;
+    // ...or this old, 0 means never
+    size_t rotateIntervalSec = 0;
+    // strftime format of the suffix of rotated logs
+    std::string rotateName = "%Y%m%d-%H%M%S";
+    // rotated logs kept, 0 means all
+    size_t keepSegments = 0;
+    // compress the text log with the codec chosen at build time
+    bool compress = false;
+    // accesses to the same path by the same process within this many seconds
+    // are logged once, 0 turns it off
+    size_t coalesceWindowSec = 0;
+    // maximum number of entries waiting for their window to pass
+    size_t coalesceEntries = 4096;
+    // accesses by these users, login users and executables are not logged
+    std::vector<size_t> excludeUids;
+    std::vector<size_t> excludeAuids;
+    std::vector<std::string> excludeExes;
+    // globs of paths not to log
+    std::vector<std::string> excludePaths;
+    // The kernel's audit queue, when not running as a plugin. It starts at
+    // backlogLimit records and is grown up to backlogLimitMax when it fills.
+    size_t backlogLimit = 8192;
+    size_t backlogLimitMax = 65536;
+    // kernel ticks a process waits for room in a full queue before the
+    // record is lost, 0 means no waiting
+    size_t backlogWaitTime = 100;
+    // records per second the kernel sends at most, 0 means no limit
+    size_t rateLimit = 0;
+    // drop read events while dirwatch can't keep up
+    bool shedReads = true;
+    // uid -> user name cache, per parser thread
+    size_t userCacheSize = 4096;
+    size_t userCacheTtlSec = 600;
 };
 
-Result<Config> readConfig();
\ No newline at end of file
+Result<Config> readConfig();
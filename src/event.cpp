@@ -1,14 +1,15 @@
 #include <event.hpp>
 
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <libaudit.h>
-#include <sstream>
+#include <scan.hpp>
 #include <string.h>
-#include <pwd.h>
 
 namespace {
-Result<std::pair<AccessType, std::string>> getAccessTypeAndPath(
-    std::string auditKey)
+Result<std::pair<AccessType, WatchId>> getAccessTypeAndWatchId(
+    std::string_view auditKey)
 {
     if (auditKey.size() < 2) {
         return ERROR("invalid key");
@@ -31,81 +32,153 @@ Result<std::pair<AccessType, std::string>> getAccessTypeAndPath(
             return ERROR("invalid key");
     }
 
-    auditKey.erase(0, 1);
+    auto id = parseWatchId(auditKey.substr(1));
+    if (!id) {
+        return ERROR("invalid key");
+    }
+    return std::make_pair(acc, *id);
+}
 
-    return std::make_pair(acc, std::move(auditKey));
+template<size_t N>
+constexpr RecordFields fieldsOf(const std::string_view (&names)[N])
+{
+    return RecordFields{ names, N };
 }
 
-std::string accessTypeString(AccessType acc)
+constexpr std::string_view syscallFields[] = {
+    "key", "uid", "pid", "comm", "exe"
+};
+constexpr std::string_view pathFields[] = { "name", "nametype" };
+constexpr std::string_view cwdFields[] = { "cwd" };
+
+constexpr std::pair<int, RecordFields> wantedFieldTable[] = {
+    { AUDIT_SYSCALL, fieldsOf(syscallFields) },
+    { AUDIT_PATH, fieldsOf(pathFields) },
+    { AUDIT_CWD, fieldsOf(cwdFields) },
+    { AUDIT_EOE, RecordFields{ nullptr, 0 } },
+};
+
+// no slot, ends the list of pending events
+constexpr uint32_t none = UINT32_MAX;
+
+size_t hashOf(long sequenceNumber)
 {
-    switch (acc) {
-        case AccessType::Read:
-            return "read";
-        case AccessType::Write:
-            return "write";
-        case AccessType::Execute:
-            return "exec";
-        case AccessType::Attribute:
-            return "attr";
-        case AccessType::Create:
-            return "create";
-        case AccessType::Delete:
-            return "delete";
+    return mixHash(uint64_t(sequenceNumber));
+}
+
+}
+
+bool RecordFields::contains(std::string_view name) const
+{
+    for (size_t i = 0; i < this->count; ++i) {
+        if (this->names[i] == name) {
+            return true;
+        }
     }
-    // we shouldn't reach this line
-    return "weird";
+    return false;
 }
+
+const RecordFields* wantedFields(int type)
+{
+    for (const auto& [t, fields] : wantedFieldTable) {
+        if (t == type) {
+            return &fields;
+        }
+    }
+    return nullptr;
 }
 
-Result<Record> Record::parse(std::string data)
+const std::string_view* Record::find(std::string_view key) const
 {
-    Record rec;
+    for (const auto& field : this->params) {
+        if (field.first == key) {
+            return &field.second;
+        }
+    }
+    return nullptr;
+}
+
+Result<size_t> Record::parseHeader(std::string_view data,
+                                  long& timestamp,
+                                  long& milliseconds,
+                                  long& sequenceNumber)
+{
+    size_t pos = 0;
 
-    std::stringstream str(std::move(data));
-    char buf[20];
-    long trash;
+    auto expect = [&](std::string_view what) -> Result<> {
+        if (data.compare(pos, what.size(), what) != 0) {
+            return ERROR("parse error, missing " + std::string(what));
+        }
+        pos += what.size();
+        return NO_ERROR;
+    };
 
-    auto expect = [&](const std::string& what) -> Result<> {
-        str.read(buf, what.size());
-        if (str.gcount() != what.size() ||
-            strncmp(buf, what.c_str(), what.size())) {
-            return ERROR("parse error, missing " + what);
+    auto readNumber = [&](long& out) -> Result<> {
+        auto res =
+            std::from_chars(data.data() + pos, data.data() + data.size(), out);
+        if (res.ec != std::errc()) {
+            return ERROR("parse error, missing number");
         }
+        pos = res.ptr - data.data();
         return NO_ERROR;
     };
 
-    auto readUntil = [&](char end, bool allowEscape) -> std::string {
-        std::string result;
-        bool escaping = false;
-        for (char next = str.get(); !str.eof(); next = str.get()) {
-            if (allowEscape && escaping) {
-                result.push_back(next);
-                continue;
+    // starts with "audit(timestamp.milliseconds:serial): "
+    RETURN_IF_ERROR(expect("audit("));
+    RETURN_IF_ERROR(readNumber(timestamp));
+    RETURN_IF_ERROR(expect("."));
+    RETURN_IF_ERROR(readNumber(milliseconds));
+    RETURN_IF_ERROR(expect(":"));
+    RETURN_IF_ERROR(readNumber(sequenceNumber));
+    RETURN_IF_ERROR(expect("): "));
+
+    return pos;
+}
+
+Result<Record> Record::parse(std::string_view data,
+                             const RecordFields* wanted)
+{
+    Record rec;
+    DelimiterScanner scanner(data);
+    size_t pos = 0;
+
+    // Returns the text up to (not including) the end character and moves past
+    // it. If end is not found, the rest of the data is returned and found is
+    // set to false. Escaped characters are kept in the result as-is.
+    auto readUntil = [&](char end, bool allowEscape, bool& found) {
+        size_t start = pos;
+        char escape = allowEscape ? '\\' : end;
+        while (true) {
+            pos = scanner.find(pos, end, escape);
+            if (pos == data.size()) {
+                found = false;
+                return data.substr(start);
             }
-            if (next == end) {
-                break;
+            if (data[pos] == end) {
+                found = true;
+                return data.substr(start, pos++ - start);
             }
-            result.push_back(next);
-            escaping = next == '\\';
+            pos = std::min(pos + 2, data.size());
         }
-        return result;
     };
 
-    // TODO: better whitespace skipping
+    RETURN_OR_SET(pos,
+                  Record::parseHeader(data,
+                                      rec.timestamp,
+                                      rec.milliseconds,
+                                      rec.sequenceNumber));
 
-    // starts with "audit(timestamp.decimal:serial): "
-    expect("audit(");
-    str >> rec.timestamp;
-    expect(".");
-    str >> trash;
-    expect(":");
-    str >> rec.sequenceNumber;
-    expect("): ");
+    // cheap filter for the duplicate key check: one bit per key hash
+    uint64_t seenKeys = 0;
 
     // params are in key=value format, possibly key='value with spaces'
-    while (!str.eof()) {
-        auto key = readUntil('=', false /*allowEscape*/);
-        if (str.eof()) {
+    while (pos < data.size()) {
+        if (wanted != nullptr && rec.params.size() == wanted->count) {
+            break;
+        }
+        bool found;
+        auto key = readUntil('=', false /*allowEscape*/, found);
+        if (!found) {
             if (key.empty()) {
                 break;
             }
@@ -114,31 +187,40 @@ Result<Record> Record::parse(std::string data)
         if (key.empty()) {
             return ERROR("missing key");
         }
-        if (rec.params.count(key) > 0) {
-            return ERROR("duplicate key");
+        bool keep = wanted == nullptr || wanted->contains(key);
+        if (keep) {
+            auto keyBit = uint64_t(1)
+                          << ((key.size() * 31 + key.front() * 7 + key.back()) %
+                              64);
+            if ((seenKeys & keyBit) != 0 && rec.find(key) != nullptr) {
+                return ERROR("duplicate key");
+            }
+            seenKeys |= keyBit;
         }
 
-        char c = str.get();
-        if (str.eof()) {
+        if (pos == data.size()) {
             return ERROR("parse error");
         }
-        std::string value;
+        std::string_view value;
+        char c = data[pos++];
         if (c == '\'' || c == '"') {
-            value = readUntil(c, true /*allowEscape*/);
-            if (str.eof()) {
+            value = readUntil(c, true /*allowEscape*/, found);
+            if (!found) {
                 return ERROR("parse error");
             }
-            auto c2 = str.get();
-            if (!str.eof() && c2 != ' ') {
+            if (pos < data.size() && data[pos++] != ' ') {
                 return ERROR("parse error");
             }
         } else {
-            value.push_back(c);
-            value += readUntil(' ', false /*allowEscape*/);
-            // no eof check, it's ok to run out here
+            size_t start = pos - 1;
+            readUntil(' ', false /*allowEscape*/, found);
+            // it's ok to run out here
+            value = data.substr(start, pos - start - (found ? 1 : 0));
         }
 
-        rec.params.emplace(std::move(key), std::move(value));
+        if (keep) {
+            rec.params.push_back(Record::Field(key, value));
+        }
     }
 
     return std::move(rec);
@@ -147,61 +229,88 @@ Result<Record> Record::parse(std::string data)
 bool Event::receiveRecord(int type, const Record& record)
 {
     if (type == AUDIT_SYSCALL) {
-        auto keyIt = record.params.find("key");
-        if (keyIt == record.params.end()) {
+        auto key = record.find("key");
+        if (key == nullptr) {
             return true;
         }
-        auto res = getAccessTypeAndPath(keyIt->second);
+        auto res = getAccessTypeAndWatchId(*key);
         if (res.isError()) {
             return true;
         }
-        auto accPath = std::get<1>(res);
-        this->keyPath = accPath.second;
-        this->accessType = accPath.first;
-        this->timestamp = record.timestamp;
-
-        auto uidIt = record.params.find("uid");
-        auto pidIt = record.params.find("pid");
+        auto uid = record.find("uid");
+        auto pid = record.find("pid");
 
-        if (uidIt == record.params.end() || pidIt == record.params.end()) {
+        if (uid == nullptr || pid == nullptr) {
             return true;
         }
-        
-        this->uid = uidIt->second;
-        this->pid = pidIt->second;
-        
-        int uidInt = atoi(this->uid.c_str());
-        auto passwd = getpwuid(uidInt);
-        if (passwd == nullptr) {
-            this->username = this->uid;
-        } else {
-            this->username = passwd->pw_name;
+
+        auto [access, id] = std::get<1>(res);
+        this->watchId = id;
+        this->accessType = access;
+        this->timestamp = record.timestamp;
+        this->milliseconds = record.milliseconds;
+        this->uid = *uid;
+        this->pid = *pid;
+
+        // the kernel fills in the process name, no need to look at /proc
+        if (auto comm = record.find("comm")) {
+            this->comm = *comm;
+        }
+        if (auto exe = record.find("exe")) {
+            this->exe = *exe;
         }
     } else if (type == AUDIT_PATH) {
-        auto nameIt = record.params.find("name");
-        if (nameIt == record.params.end()) {
+        auto name = record.find("name");
+        if (name == nullptr) {
             return false;
         }
-        auto nameTypeIt = record.params.find("nametype");
-        if (nameTypeIt == record.params.end()) {
+        auto nameType = record.find("nametype");
+        if (nameType == nullptr) {
             return false;
         }
-        if (nameTypeIt->second != "PARENT") {
-            this->additionalPaths.emplace_back(nameTypeIt->second,
-                                               nameIt->second);
+        if (*nameType != "PARENT") {
+            this->additionalPaths.emplace_back(*nameType, *name);
         }
     } else if (type == AUDIT_CWD) {
-        auto cwdIt = record.params.find("cwd");
-        if (cwdIt == record.params.end()) {
+        auto cwd = record.find("cwd");
+        if (cwd == nullptr) {
             return false;
         }
-        this->basePath = cwdIt->second;
+        this->basePath = *cwd;
     } else if (type == AUDIT_EOE) {
         return true;
     }
     return false;
 }
 
+void Event::clear()
+{
+    this->watchId.reset();
+    this->accessType = AccessType::Read;
+    this->timestamp = 0;
+    this->milliseconds = 0;
+    this->basePath.clear();
+    this->additionalPaths.clear();
+    this->uid.clear();
+    this->pid.clear();
+    this->username.clear();
+    this->comm.clear();
+    this->exe.clear();
+    this->timing = EventTiming();
+}
+
+void Event::resolveUserName(UserCache& users)
+{
+    uid_t uidNum;
+    auto res = std::from_chars(
+        this->uid.data(), this->uid.data() + this->uid.size(), uidNum);
+    if (res.ec != std::errc()) {
+        this->username = this->uid;
+        return;
+    }
+    this->username = users.lookup(uidNum);
+}
+
 Result<std::string> Event::resolvePath(const std::string& path) const
 {
     if (path.empty()) {
@@ -240,6 +349,29 @@ Event::calculateActions() const
     return std::move(result);
 }
 
+WatchId Event::getWatchId() const
+{
+    return *this->watchId;
+}
+
+AccessType Event::getAccessType() const
+{
+    return this->accessType;
+}
+
+bool Event::isReadOnly() const
+{
+    if (this->accessType != AccessType::Read) {
+        return false;
+    }
+    for (const auto& [action, path] : this->additionalPaths) {
+        if (action == "CREATE" || action == "DELETE") {
+            return false;
+        }
+    }
+    return true;
+}
+
 const std::string& Event::getUid() const
 {
     return this->uid;
@@ -255,117 +387,257 @@ const std::string& Event::getUserName() const
     return this->username;
 }
 
+const std::string& Event::getComm() const
+{
+    return this->comm;
+}
+
+const std::string& Event::getExe() const
+{
+    return this->exe;
+}
+
 long Event::getTimestamp() const
 {
     return this->timestamp;
 }
 
-EventHandler::EventHandler(int auditFd)
-    : auditFd(auditFd)
-{}
+long Event::getMilliseconds() const
+{
+    return this->milliseconds;
+}
 
-Result<> EventHandler::watchDirectory(const std::string& path)
+EventTiming& Event::getTiming()
 {
-    RETURN_OR_SET(auto watch, DirectoryWatch::create(this->auditFd, path));
-    this->watches.emplace_back(std::move(watch));
+    return this->timing;
+}
 
-    return NO_ERROR;
+const EventTiming& Event::getTiming() const
+{
+    return this->timing;
 }
 
-Result<> EventHandler::printLog(long timestamp,
-                                const std::string& path,
-                                AccessType access,
-                                const std::string& pid,
-                                const std::string& uid)
+bool Event::shouldProcess() const
 {
-    this->outputFile << timestamp << "\t" << path << "\t" << accessTypeString(access)
-         << "\t" << pid << "\t" << uid << std::endl;
-    return NO_ERROR;
+    return this->watchId.has_value();
+}
+
+EventAssembler::EventAssembler(const Config& config)
+    : slots(config.pendingEvents)
+    , oldest(none)
+    , newest(none)
+    , timeout(config.pendingTimeoutSec)
+    , users(config.userCacheSize, std::chrono::seconds(config.userCacheTtlSec))
+    , pendingCount(0)
+    , timedOut(0)
+    , evicted(0)
+{
+    for (size_t i = this->slots.size(); i > 0; --i) {
+        this->freeSlots.push_back(i - 1);
+    }
 }
 
-size_t EventHandler::directoryIndex(const PathParts& path)
+std::optional<uint32_t> EventAssembler::find(long sequenceNumber) const
 {
-    for (size_t i = 0; i < this->watches.size(); ++i) {
-        if (this->watches[i].contains(path)) {
-            return i;
+    return this->index.find(hashOf(sequenceNumber), [&](uint32_t id) {
+        return this->slots[id].sequenceNumber == sequenceNumber;
+    });
+}
+
+uint32_t EventAssembler::start(long sequenceNumber, long timestamp)
+{
+    uint32_t id = this->freeSlots.back();
+    this->freeSlots.pop_back();
+    auto& slot = this->slots[id];
+    slot.sequenceNumber = sequenceNumber;
+    slot.started = timestamp;
+    slot.older = this->newest;
+    slot.newer = none;
+    if (this->newest == none) {
+        this->oldest = id;
+    } else {
+        this->slots[this->newest].newer = id;
+    }
+    this->newest = id;
+    this->index.insert(id, [this](uint32_t i) {
+        return hashOf(this->slots[i].sequenceNumber);
+    });
+    this->pendingCount.store(this->index.size(), std::memory_order_relaxed);
+    return id;
+}
+
+void EventAssembler::release(uint32_t id)
+{
+    auto& slot = this->slots[id];
+    if (slot.older == none) {
+        this->oldest = slot.newer;
+    } else {
+        this->slots[slot.older].newer = slot.newer;
+    }
+    if (slot.newer == none) {
+        this->newest = slot.older;
+    } else {
+        this->slots[slot.newer].older = slot.older;
+    }
+    this->index.erase(id, [this](uint32_t i) {
+        return hashOf(this->slots[i].sequenceNumber);
+    });
+    slot.event.clear();
+    this->freeSlots.push_back(id);
+    this->pendingCount.store(this->index.size(), std::memory_order_relaxed);
+}
+
+std::optional<Event> EventAssembler::addRecord(int type, const Record& record)
+{
+    // the records of an event arrive together, anything much older than this
+    // one won't be completed anymore
+    while (this->oldest != none &&
+           this->slots[this->oldest].started + this->timeout <
+               record.timestamp) {
+        this->release(this->oldest);
+        this->timedOut.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto id = this->find(record.sequenceNumber);
+    if (!id) {
+        if (type != AUDIT_SYSCALL) {
+            return std::nullopt;
         }
+        if (this->freeSlots.empty()) {
+            this->release(this->oldest);
+            this->evicted.fetch_add(1, std::memory_order_relaxed);
+        }
+        id = this->start(record.sequenceNumber, record.timestamp);
+    }
+
+    auto& slot = this->slots[*id];
+    if (!slot.event.receiveRecord(type, record)) {
+        return std::nullopt;
+    }
+    if (!slot.event.shouldProcess()) {
+        this->release(*id);
+        return std::nullopt;
     }
+    auto finished = std::move(slot.event);
+    this->release(*id);
+    finished.resolveUserName(this->users);
+    return std::move(finished);
+}
 
-    return this->watches.size();
+AssemblerStats EventAssembler::stats() const
+{
+    return { this->pendingCount.load(std::memory_order_relaxed),
+             this->timedOut.load(std::memory_order_relaxed),
+             this->evicted.load(std::memory_order_relaxed) };
+}
+
+EventHandler::EventHandler(std::unique_ptr<RuleSink> ruleSink,
+                           Exclusions exclusions,
+                           const Config& config)
+    : ruleSink(std::move(ruleSink))
+    , exclusions(std::move(exclusions))
+    , watches(*this->ruleSink, config.scanThreads, &this->exclusions)
+    , flushInterval(config.flushIntervalMs)
+    , syncInterval(config.syncIntervalMs)
+    , ruleCount(0)
+    , watchedPaths(0)
+    , treeBytes(0)
+{}
+
+Result<> EventHandler::printLog(const Event& event,
+                                const std::string& path,
+                                AccessType access)
+{
+    return this->output->append({ event.getTimestamp(),
+                                  path,
+                                  access,
+                                  event.getPid(),
+                                  event.getUid(),
+                                  event.getUserName(),
+                                  event.getComm() });
 }
 
 Result<> EventHandler::processEvent(const Event& event)
 {
+    if (!event.shouldProcess()) {
+        return NO_ERROR;
+    }
+    if (this->exclusions.hasExes() &&
+        this->exclusions.excludesExe(event.getExe())) {
+        return NO_ERROR;
+    }
     RETURN_OR_SET(auto actions, event.calculateActions());
 
+    if (actions.empty()) {
+        // no PATH records, e.g. for some syscalls on file descriptors; the
+        // rule that fired still tells which path was accessed
+        if (!this->watches.pathOf(event.getWatchId(), this->normPath)) {
+            return NO_ERROR;
+        }
+        return this->printLog(event, this->normPath, event.getAccessType());
+    }
+
     for (const auto& [path, action] : actions) {
-        PathParts fsPath(path);
-        auto idx = this->directoryIndex(fsPath);
-        if (idx == this->watches.size()) {
+        normalizePath(path, this->normPath);
+        auto loc = this->watches.locate(this->normPath);
+        if (!loc.watched || this->exclusions.excludesPath(this->normPath)) {
             continue;
         }
-        RETURN_OR_SET(auto relPath, this->watches[idx].getRelPath(fsPath));
         if (action == AccessType::Create) {
-            RETURN_IF_ERROR(this->watches[idx].watchPath(relPath));
+            RETURN_IF_ERROR(this->watches.watchPath(loc, this->normPath));
         } else if (action == AccessType::Delete) {
-            RETURN_IF_ERROR(this->watches[idx].unwatchPath(relPath));
+            RETURN_IF_ERROR(this->watches.unwatchPath(loc));
         }
-        auto normPath = fsPath.toString(true /*absolute*/);
-        RETURN_IF_ERROR(this->printLog(event.getTimestamp(),
-                                       normPath,
-                                       action,
-                                       event.getPid(),
-                                       event.getUserName()));
+        RETURN_IF_ERROR(this->printLog(event, this->normPath, action));
     }
 
     return NO_ERROR;
 }
 
-Result<std::shared_ptr<EventHandler>> EventHandler::create(int auditFd,
-                                                           const Config& config)
+Result<std::shared_ptr<EventHandler>> EventHandler::create(
+    std::unique_ptr<RuleSink> ruleSink,
+    const Config& config)
 {
-    auto eventHandler =
-        std::shared_ptr<EventHandler>(new EventHandler(auditFd));
-    eventHandler->outputFile.open(config.outputPath, std::ios_base::app);
-    if (!eventHandler->outputFile.is_open()) {
-        return ERROR("can't open output file");
-    }
-
-    for (const auto& path : config.paths) {
-        RETURN_IF_ERROR(eventHandler->watchDirectory(path));
+    RETURN_OR_SET(auto exclusions, Exclusions::create(config));
+    auto eventHandler = std::shared_ptr<EventHandler>(new EventHandler(
+        std::move(ruleSink), std::move(exclusions), config));
+    RETURN_OR_SET(eventHandler->output, openEventLog(config));
+
+    for (const auto& [path, mode] : config.paths) {
+        normalizePath(path, eventHandler->normPath);
+        RETURN_IF_ERROR(
+            eventHandler->watches.addRoot(eventHandler->normPath, mode));
     }
+    eventHandler->updateStats();
 
     return std::move(eventHandler);
 }
 
-Result<> EventHandler::nextRecord()
+Result<> EventHandler::addTimers(EventLoop& loop)
 {
-    audit_reply reply;
-
-    RETURN_IF_C_ERROR(
-        audit_get_reply(this->auditFd, &reply, GET_REPLY_BLOCKING, 0));
-
-    // audit_get_reply seems to return garbage sometimes, try to filter it out
-    if (reply.type < 1000 || reply.type > 1807) {
-        return NO_ERROR;
+    RETURN_IF_ERROR(loop.addTimer(this->flushInterval, [this]() {
+        this->updateStats();
+        return this->output->flush();
+    }));
+    if (this->syncInterval.count() > 0) {
+        RETURN_IF_ERROR(loop.addTimer(this->syncInterval, [this]() {
+            return this->output->sync();
+        }));
     }
+    return NO_ERROR;
+}
 
-    std::string msgData(reply.message, reply.len);
-    std::cout << msgData << std::endl;
-    RETURN_OR_SET(auto msg, Record::parse(msgData));
-
-    auto ev = this->pendingEvents.find(msg.sequenceNumber);
-    if (ev == this->pendingEvents.end() && reply.type == AUDIT_SYSCALL) {
-        ev = this->pendingEvents.emplace(msg.sequenceNumber, Event()).first;
-    }
-    if (ev != this->pendingEvents.end() &&
-        ev->second.receiveRecord(reply.type, msg)) {
-        auto res = this->processEvent(this->pendingEvents[msg.sequenceNumber]);
-        if (res.isError()) {
-            LOG << std::get<0>(res).message << std::endl;
-        }
-        this->pendingEvents.erase(msg.sequenceNumber);
-    }
+void EventHandler::updateStats()
+{
+    auto usage = this->watches.memoryUsage();
+    this->ruleCount.store(this->watches.ruleCount(), std::memory_order_relaxed);
+    this->watchedPaths.store(usage.nodes, std::memory_order_relaxed);
+    this->treeBytes.store(usage.bytes, std::memory_order_relaxed);
+}
 
-    return NO_ERROR;
+WatchStats EventHandler::watchStats() const
+{
+    return { this->ruleCount.load(std::memory_order_relaxed),
+             this->watchedPaths.load(std::memory_order_relaxed),
+             this->treeBytes.load(std::memory_order_relaxed) };
 }
@@ -1,41 +1,87 @@
 #pragma once
 
-#include <map>
+#include <atomic>
+#include <optional>
 #include <string>
+#include <string_view>
 
+#include <chrono>
 #include <config.hpp>
-#include <fstream>
+#include <eventlog.hpp>
+#include <exclude.hpp>
+#include <identity.hpp>
+#include <idindex.hpp>
+#include <loop.hpp>
 #include <util.hpp>
 #include <vector>
 #include <watch.hpp>
 
-enum class AccessType
+// Set of field names to extract from a record
+struct RecordFields
 {
-    Read,
-    Write,
-    Execute,
-    Attribute,
-    Create,
-    Delete
+    const std::string_view* names;
+    size_t count;
+
+    bool contains(std::string_view name) const;
 };
 
+// Fields that Event::receiveRecord uses for the given record type, or nullptr
+// if records of that type are not used at all.
+const RecordFields* wantedFields(int type);
+
+// Parsed view of a single audit message. Keys and values point into the
+// message buffer passed to parse(), so the record must not outlive it.
 struct Record
 {
-    std::map<std::string, std::string> params;
+    using Field = std::pair<std::string_view, std::string_view>;
+
+    SmallVector<Field, 32> params;
     long timestamp;
+    // the fraction of a second of the timestamp
+    long milliseconds;
     long sequenceNumber;
 
-    static Result<Record> parse(std::string data);
+    // returns nullptr if the key is not present
+    const std::string_view* find(std::string_view key) const;
+
+    // Parses the "audit(timestamp.milliseconds:serial): " prefix, returns the
+    // position after it.
+    static Result<size_t> parseHeader(std::string_view data,
+                                      long& timestamp,
+                                      long& milliseconds,
+                                      long& sequenceNumber);
+
+    // Parses all fields, or only the given ones if wanted is set. In the
+    // latter case parsing stops as soon as all wanted fields are found.
+    static Result<Record> parse(std::string_view data,
+                                const RecordFields* wanted = nullptr);
+};
+
+// When an event passed through the pipeline
+struct EventTiming
+{
+    using Clock = std::chrono::steady_clock;
+
+    // the record completing the event was read from the source
+    Clock::time_point read;
+    // the event was assembled by a parser thread
+    Clock::time_point assembled;
+    // the writer thread has processed it
+    Clock::time_point processed;
 };
 
 class Event
 {
-    std::string keyPath;
+    // the watch whose rule produced the event, unset if the SYSCALL record
+    // wasn't from one of dirwatch's rules
+    std::optional<WatchId> watchId;
     std::string basePath;
     std::vector<std::pair<std::string, std::string>> additionalPaths;
-    AccessType accessType;
-    long timestamp;
-    std::string uid, pid, username;
+    AccessType accessType = AccessType::Read;
+    long timestamp = 0;
+    long milliseconds = 0;
+    std::string uid, pid, username, comm, exe;
+    EventTiming timing;
 
     Result<std::string> resolvePath(const std::string& path) const;
     Result<AccessType> resolveAction(const std::string& action) const;
@@ -45,42 +91,138 @@ public:
     // are expected
     bool receiveRecord(int type, const Record& record);
 
+    // forgets the received records, keeping the allocated memory
+    void clear();
+
+    void resolveUserName(UserCache& users);
+
     Result<std::vector<std::pair<std::string, AccessType>>> calculateActions()
         const;
 
+    // only valid if shouldProcess()
+    WatchId getWatchId() const;
+    AccessType getAccessType() const;
+    // True if the event only reads. An event from a read rule can still
+    // create or delete entries, e.g. open() with O_CREAT.
+    bool isReadOnly() const;
+
     const std::string& getUid() const;
     const std::string& getPid() const;
-    const std::string &getUserName() const;
-    
+    const std::string& getUserName() const;
+    const std::string& getComm() const;
+    const std::string& getExe() const;
+
     long getTimestamp() const;
+    // the fraction of a second of the timestamp
+    long getMilliseconds() const;
+
+    EventTiming& getTiming();
+    const EventTiming& getTiming() const;
 
+    // true if the event matched one of dirwatch's rules
     bool shouldProcess() const;
 };
 
-class EventHandler
+struct AssemblerStats
+{
+    // events waiting for more records
+    size_t pending;
+    // incomplete events dropped because no record completed them in time...
+    size_t timedOut;
+    // ...or because the table was full
+    size_t evicted;
+};
+
+// Collects the records belonging to the same event, by sequence number.
+// Incomplete events are kept in a fixed number of reused slots, so lost or
+// truncated record groups can't pile up: an event is dropped once records
+// pendingTimeoutSec newer than its first one arrive, or early, oldest first,
+// when all slots are taken.
+class EventAssembler
 {
-    std::vector<DirectoryWatch> watches;
-    std::map<long, Event> pendingEvents;
-    std::ofstream outputFile;
-    int auditFd;
+    struct Slot
+    {
+        Event event;
+        long sequenceNumber;
+        long started;
+        // neighbours in order of arrival
+        uint32_t older;
+        uint32_t newer;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    IdIndex index;
+    uint32_t oldest;
+    uint32_t newest;
+    long timeout;
+    UserCache users;
+
+    // written by the assembling thread only, read by any
+    std::atomic<size_t> pendingCount;
+    std::atomic<size_t> timedOut;
+    std::atomic<size_t> evicted;
+
+    std::optional<uint32_t> find(long sequenceNumber) const;
+    uint32_t start(long sequenceNumber, long timestamp);
+    // returns the slot to the free list
+    void release(uint32_t id);
+
+public:
+    EventAssembler(const Config& config);
+
+    // Returns the event if the record completed it. Events that didn't match
+    // a dirwatch rule are dropped.
+    std::optional<Event> addRecord(int type, const Record& record);
 
-    EventHandler(int auditFd);
+    AssemblerStats stats() const;
+};
 
-    Result<> watchDirectory(const std::string& path);
+struct WatchStats
+{
+    size_t rules;
+    size_t paths;
+    // memory taken by the watch tree
+    size_t bytes;
+};
 
-    Result<> printLog(long timestamp,
+class EventHandler
+{
+    std::unique_ptr<RuleSink> ruleSink;
+    Exclusions exclusions;
+    WatchTree watches;
+    std::unique_ptr<EventLog> output;
+    // reused for normalizing event paths
+    std::string normPath;
+    std::chrono::milliseconds flushInterval;
+    std::chrono::milliseconds syncInterval;
+
+    // the watch tree's figures for other threads, updated by the flush timer
+    std::atomic<size_t> ruleCount;
+    std::atomic<size_t> watchedPaths;
+    std::atomic<size_t> treeBytes;
+
+    void updateStats();
+
+    EventHandler(std::unique_ptr<RuleSink> ruleSink,
+                 Exclusions exclusions,
+                 const Config& config);
+
+    Result<> printLog(const Event& event,
                       const std::string& path,
-                      AccessType access,
-                      const std::string& pid,
-                      const std::string& uid);
+                      AccessType access);
 
-    size_t directoryIndex(const PathParts& path);
+public:
+    static Result<std::shared_ptr<EventHandler>> create(
+        std::unique_ptr<RuleSink> ruleSink,
+        const Config& config);
 
     Result<> processEvent(const Event& event);
 
-public:
-    static Result<std::shared_ptr<EventHandler>> create(int auditFd,
-                                                        const Config& config);
+    // Sets up periodic log flushing and syncing on the loop that runs
+    // processEvent.
+    Result<> addTimers(EventLoop& loop);
 
-    Result<> nextRecord();
+    // can be called from any thread
+    WatchStats watchStats() const;
 };
@@ -0,0 +1,453 @@
+#include <coalesce.hpp>
+#include <eventlog.hpp>
+#include <rotation.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <errno.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char segmentMagic[8] = { 'D', 'W', 'E', 'V', 'T', 'L', 'O', 'G' };
+constexpr uint32_t segmentVersion = 2;
+
+struct SegmentHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint8_t reserved[24];
+};
+
+static_assert(sizeof(SegmentHeader) == sizeof(BinaryLogRecord));
+
+// new dictionary entries are written right away, this only has to hold one
+constexpr size_t dictionaryBufferSize = 4096;
+
+std::string segmentPath(const std::string& directory, size_t index)
+{
+    return directory + "/events." + std::to_string(index);
+}
+
+std::string dictionaryPath(const std::string& directory)
+{
+    return directory + "/strings";
+}
+
+uint32_t parseNumber(std::string_view str)
+{
+    uint32_t value = 0;
+    std::from_chars(str.data(), str.data() + str.size(), value);
+    return value;
+}
+
+// Calls callback with every complete entry of the dictionary file and
+// returns the size of the complete part.
+template<class F>
+size_t readDictionary(const std::string& path, F&& callback)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input.is_open()) {
+        return 0;
+    }
+    std::string str;
+    size_t complete = 0;
+    uint32_t length;
+    while (input.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+        str.resize(length);
+        if (!input.read(str.data(), length)) {
+            break;
+        }
+        complete += sizeof(length) + length;
+        callback(str);
+    }
+    return complete;
+}
+
+// A segment of the binary log mapped into memory, read-only.
+class MappedSegment
+{
+    void* data = MAP_FAILED;
+    size_t size = 0;
+
+public:
+    MappedSegment() = default;
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+
+    ~MappedSegment()
+    {
+        if (this->data != MAP_FAILED) {
+            munmap(this->data, this->size);
+        }
+    }
+
+    // false if the file doesn't exist
+    Result<bool> open(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                return false;
+            }
+            return ERROR("can't open " + path + ": " + strerror(errno));
+        }
+        ScopeGuard closeFd([&]() { close(fd); });
+        struct stat st;
+        RETURN_IF_C_ERROR(fstat(fd, &st));
+        this->size = st.st_size;
+        if (this->size < sizeof(SegmentHeader)) {
+            return ERROR(path + " is truncated");
+        }
+        this->data = mmap(nullptr, this->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (this->data == MAP_FAILED) {
+            return ERROR("can't map " + path + ": " + strerror(errno));
+        }
+        madvise(this->data, this->size, MADV_SEQUENTIAL);
+
+        auto header = static_cast<const SegmentHeader*>(this->data);
+        if (memcmp(header->magic, segmentMagic, sizeof(segmentMagic)) != 0 ||
+            header->version != segmentVersion ||
+            header->recordSize != sizeof(BinaryLogRecord)) {
+            return ERROR(path + " is not a dirwatch log segment");
+        }
+        return true;
+    }
+
+    const BinaryLogRecord* begin() const
+    {
+        return static_cast<const BinaryLogRecord*>(this->data) + 1;
+    }
+
+    const BinaryLogRecord* end() const
+    {
+        return static_cast<const BinaryLogRecord*>(this->data) +
+               this->size / sizeof(BinaryLogRecord);
+    }
+};
+
+Result<std::unique_ptr<EventLog>> openOutput(const Config& config)
+{
+    if (config.logFormat == LogFormat::Binary) {
+        RETURN_OR_SET(auto log, BinaryLog::create(config.outputPath));
+        return std::unique_ptr<EventLog>(std::move(log));
+    }
+    if (config.rotateBytes > 0 || config.rotateIntervalSec > 0 ||
+        config.compress) {
+        RETURN_OR_SET(auto log, RotatingLog::create(config));
+        return std::unique_ptr<EventLog>(std::move(log));
+    }
+    RETURN_OR_SET(auto output,
+                  LogWriter::create(config.outputPath, config.flushBytes));
+    return std::unique_ptr<EventLog>(
+        std::make_unique<TextLog>(std::move(output)));
+}
+
+}
+
+std::string_view accessTypeString(AccessType acc)
+{
+    switch (acc) {
+        case AccessType::Read:
+            return "read";
+        case AccessType::Write:
+            return "write";
+        case AccessType::Execute:
+            return "exec";
+        case AccessType::Attribute:
+            return "attr";
+        case AccessType::Create:
+            return "create";
+        case AccessType::Delete:
+            return "delete";
+    }
+    // we shouldn't reach this line
+    return "weird";
+}
+
+void formatLogLine(const LogEntry& entry, std::string& line)
+{
+    char number[24];
+    auto numberEnd =
+        std::to_chars(number, number + sizeof(number), entry.timestamp).ptr;
+
+    line.assign(number, numberEnd);
+    line.append("\t").append(entry.path);
+    line.append("\t").append(accessTypeString(entry.access));
+    line.append("\t").append(entry.pid);
+    line.append("\t").append(entry.userName);
+    line.append("\t").append(entry.comm);
+    if (entry.count > 0) {
+        numberEnd =
+            std::to_chars(number, number + sizeof(number), entry.count).ptr;
+        line.append("\t").append(number, numberEnd);
+        numberEnd = std::to_chars(
+                        number, number + sizeof(number), entry.lastTimestamp)
+                        .ptr;
+        line.append("\t").append(number, numberEnd);
+    }
+    line.append("\n");
+}
+
+Result<std::unique_ptr<EventLog>> openEventLog(const Config& config)
+{
+    RETURN_OR_SET(auto log, openOutput(config));
+    if (config.coalesceWindowSec == 0) {
+        return std::move(log);
+    }
+    return std::unique_ptr<EventLog>(std::make_unique<CoalescingLog>(
+        std::move(log), config.coalesceWindowSec, config.coalesceEntries));
+}
+
+TextLog::TextLog(std::shared_ptr<LogWriter> output)
+    : output(std::move(output))
+{}
+
+Result<> TextLog::append(const LogEntry& entry)
+{
+    formatLogLine(entry, this->line);
+    return this->output->append(this->line);
+}
+
+Result<> TextLog::flush()
+{
+    return this->output->flush();
+}
+
+Result<> TextLog::sync()
+{
+    return this->output->sync();
+}
+
+BinaryLog::BinaryLog(std::string directory, size_t segmentBytes)
+    : directory(std::move(directory))
+    , segmentBytes(segmentBytes)
+    , segment(0)
+    , segmentFd(-1)
+    , mapping(nullptr)
+    , used(0)
+    , stringCount(0)
+{}
+
+BinaryLog::~BinaryLog()
+{
+    this->closeSegment();
+}
+
+Result<std::unique_ptr<BinaryLog>> BinaryLog::create(
+    const std::string& directory,
+    size_t segmentBytes)
+{
+    if (segmentBytes < 2 * sizeof(BinaryLogRecord)) {
+        return ERROR("log segments too small");
+    }
+    std::error_code err;
+    std::filesystem::create_directories(directory, err);
+    if (err) {
+        return ERROR("can't create " + directory + ": " + err.message());
+    }
+
+    auto log = std::unique_ptr<BinaryLog>(new BinaryLog(
+        directory,
+        segmentBytes / sizeof(BinaryLogRecord) * sizeof(BinaryLogRecord)));
+    RETURN_IF_ERROR(log->loadDictionary());
+
+    size_t last = 0;
+    while (std::filesystem::exists(segmentPath(directory, last + 1), err)) {
+        last++;
+    }
+    RETURN_IF_ERROR(log->openSegment(last));
+    return std::move(log);
+}
+
+Result<> BinaryLog::loadDictionary()
+{
+    auto path = dictionaryPath(this->directory);
+    auto complete = readDictionary(path, [this](std::string_view str) {
+        this->strings.acquire(str);
+        this->stringCount++;
+    });
+    // drop a partly written entry
+    if (std::filesystem::exists(path)) {
+        RETURN_IF_C_ERROR(truncate(path.c_str(), complete));
+    }
+    RETURN_OR_SET(this->dictionary,
+                  LogWriter::create(path, dictionaryBufferSize));
+    return NO_ERROR;
+}
+
+Result<> BinaryLog::openSegment(size_t index)
+{
+    auto path = segmentPath(this->directory, index);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return ERROR("can't open " + path + ": " + strerror(errno));
+    }
+    ScopeGuard closeFd([&]() { close(fd); });
+    struct stat st;
+    RETURN_IF_C_ERROR(fstat(fd, &st));
+    bool fresh = st.st_size == 0;
+    if (size_t(st.st_size) != this->segmentBytes) {
+        if (!fresh) {
+            return ERROR(path + " has the wrong size for a log segment");
+        }
+        // the rest of the file stays sparse until it's written
+        RETURN_IF_C_ERROR(ftruncate(fd, this->segmentBytes));
+    }
+    void* mapping = mmap(nullptr,
+                         this->segmentBytes,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         fd,
+                         0);
+    if (mapping == MAP_FAILED) {
+        return ERROR("can't map " + path + ": " + strerror(errno));
+    }
+    closeFd.disable();
+
+    this->segment = index;
+    this->segmentFd = fd;
+    this->mapping = static_cast<char*>(mapping);
+    auto header = reinterpret_cast<SegmentHeader*>(this->mapping);
+    if (fresh) {
+        memcpy(header->magic, segmentMagic, sizeof(segmentMagic));
+        header->version = segmentVersion;
+        header->recordSize = sizeof(BinaryLogRecord);
+        this->used = sizeof(SegmentHeader);
+        return NO_ERROR;
+    }
+    if (memcmp(header->magic, segmentMagic, sizeof(segmentMagic)) != 0 ||
+        header->version != segmentVersion ||
+        header->recordSize != sizeof(BinaryLogRecord)) {
+        this->closeSegment();
+        return ERROR(path + " is not a dirwatch log segment");
+    }
+
+    // records are filled in order, continue after the last one
+    auto records = reinterpret_cast<BinaryLogRecord*>(this->mapping) + 1;
+    auto end = reinterpret_cast<BinaryLogRecord*>(this->mapping +
+                                                  this->segmentBytes);
+    auto next =
+        std::partition_point(records, end, [](const BinaryLogRecord& r) {
+            return r.timestamp != 0;
+        });
+    this->used = reinterpret_cast<char*>(next) - this->mapping;
+    return NO_ERROR;
+}
+
+void BinaryLog::closeSegment()
+{
+    if (this->mapping == nullptr) {
+        return;
+    }
+    munmap(this->mapping, this->segmentBytes);
+    close(this->segmentFd);
+    this->mapping = nullptr;
+    this->segmentFd = -1;
+}
+
+Result<uint32_t> BinaryLog::intern(std::string_view str)
+{
+    if (auto id = this->strings.find(str)) {
+        return *id;
+    }
+    uint32_t length = str.size();
+    RETURN_IF_ERROR(this->dictionary->append(std::string_view(
+        reinterpret_cast<const char*>(&length), sizeof(length))));
+    RETURN_IF_ERROR(this->dictionary->append(str));
+    // ids are handed out in order, as nothing is ever released
+    this->strings.acquire(str);
+    return this->stringCount++;
+}
+
+Result<> BinaryLog::append(const LogEntry& entry)
+{
+    if (this->used == this->segmentBytes) {
+        this->closeSegment();
+        RETURN_IF_ERROR(this->openSegment(this->segment + 1));
+    }
+
+    BinaryLogRecord record = {};
+    record.timestamp = entry.timestamp;
+    RETURN_OR_SET(record.path, this->intern(entry.path));
+    RETURN_OR_SET(record.userName, this->intern(entry.userName));
+    RETURN_OR_SET(record.comm, this->intern(entry.comm));
+    // the record must not refer to strings that aren't written yet
+    RETURN_IF_ERROR(this->dictionary->flush());
+    record.pid = parseNumber(entry.pid);
+    record.uid = parseNumber(entry.uid);
+    record.access = entry.access;
+    record.count = entry.count;
+    record.span = entry.count > 0 ? entry.lastTimestamp - entry.timestamp : 0;
+
+    memcpy(this->mapping + this->used, &record, sizeof(record));
+    this->used += sizeof(record);
+    return NO_ERROR;
+}
+
+Result<> BinaryLog::flush()
+{
+    // records are in the page cache as soon as they are copied
+    return this->dictionary->flush();
+}
+
+Result<> BinaryLog::sync()
+{
+    RETURN_IF_ERROR(this->dictionary->sync());
+    RETURN_IF_C_ERROR(msync(this->mapping, this->used, MS_SYNC));
+    return NO_ERROR;
+}
+
+Result<> readBinaryLog(const std::string& directory,
+                       const std::function<Result<>(const LogEntry&)>& callback)
+{
+    // strings are kept in one pool, as offset and length
+    std::string pool;
+    std::vector<std::pair<size_t, size_t>> strings;
+    readDictionary(dictionaryPath(directory), [&](std::string_view str) {
+        strings.emplace_back(pool.size(), str.size());
+        pool.append(str);
+    });
+    auto lookup = [&](uint32_t id) -> std::string_view {
+        if (id >= strings.size()) {
+            return "?";
+        }
+        return std::string_view(pool).substr(strings[id].first,
+                                             strings[id].second);
+    };
+
+    char pid[16], uid[16];
+    for (size_t index = 0;; ++index) {
+        MappedSegment segment;
+        RETURN_OR_SET(bool found,
+                      segment.open(segmentPath(directory, index)));
+        if (!found) {
+            return index == 0 ? ERROR("no log segments in " + directory)
+                              : Result<>(NO_ERROR);
+        }
+        for (auto rec = segment.begin();
+             rec != segment.end() && rec->timestamp != 0;
+             ++rec) {
+            auto pidEnd = std::to_chars(pid, pid + sizeof(pid), rec->pid).ptr;
+            auto uidEnd = std::to_chars(uid, uid + sizeof(uid), rec->uid).ptr;
+            LogEntry entry{ rec->timestamp,
+                            lookup(rec->path),
+                            rec->access,
+                            std::string_view(pid, pidEnd - pid),
+                            std::string_view(uid, uidEnd - uid),
+                            lookup(rec->userName),
+                            lookup(rec->comm),
+                            rec->count,
+                            rec->timestamp + rec->span };
+            RETURN_IF_ERROR(callback(entry));
+        }
+    }
+}
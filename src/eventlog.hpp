@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <config.hpp>
+#include <logwriter.hpp>
+#include <names.hpp>
+#include <util.hpp>
+
+enum class AccessType : uint8_t
+{
+    Read,
+    Write,
+    Execute,
+    Attribute,
+    Create,
+    Delete
+};
+
+std::string_view accessTypeString(AccessType acc);
+
+// One access, as written to the log
+struct LogEntry
+{
+    long timestamp;
+    std::string_view path;
+    AccessType access;
+    std::string_view pid;
+    std::string_view uid;
+    std::string_view userName;
+    std::string_view comm;
+    // number of accesses merged into the entry by coalescing, 0 if not
+    // coalesced
+    uint32_t count = 0;
+    // time of the last merged access
+    long lastTimestamp = 0;
+};
+
+// Formats entry as a line of the text log: tab separated timestamp, path,
+// access type, pid, user name and comm, then count and last timestamp for
+// coalesced entries.
+void formatLogLine(const LogEntry& entry, std::string& line);
+
+class EventLog
+{
+public:
+    virtual ~EventLog() = default;
+
+    virtual Result<> append(const LogEntry& entry) = 0;
+
+    // writes out whatever is buffered
+    virtual Result<> flush() = 0;
+
+    // flushes and makes the log durable
+    virtual Result<> sync() = 0;
+};
+
+// Opens the log at config.outputPath in config.logFormat.
+Result<std::unique_ptr<EventLog>> openEventLog(const Config& config);
+
+// The text log, one line per entry.
+class TextLog : public EventLog
+{
+    std::shared_ptr<LogWriter> output;
+    // reused for formatting log lines
+    std::string line;
+
+public:
+    TextLog(std::shared_ptr<LogWriter> output);
+
+    Result<> append(const LogEntry& entry) override;
+    Result<> flush() override;
+    Result<> sync() override;
+};
+
+// Entry of the binary log. Strings are ids in the dictionary.
+struct BinaryLogRecord
+{
+    // 0 marks the unused part of a segment
+    int64_t timestamp;
+    uint32_t path;
+    uint32_t userName;
+    uint32_t comm;
+    uint32_t pid;
+    uint32_t uid;
+    // as in LogEntry
+    uint32_t count;
+    // seconds from timestamp to the last merged access
+    uint32_t span;
+    AccessType access;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(BinaryLogRecord) == 40);
+
+// The binary log is a directory of segment files, "events.N" numbered from 0,
+// and a dictionary, "strings". Each segment has a fixed size and holds a
+// header and fixed-size records; segments are filled through a shared memory
+// mapping, so entries reach the page cache without a system call. Paths, user
+// names and process names are stored once in the dictionary, in order of
+// first use, as a 32 bit length followed by the bytes; the id of a string is
+// its position in the dictionary. New strings are written to the dictionary
+// before the record that uses them.
+class BinaryLog : public EventLog
+{
+    std::string directory;
+    size_t segmentBytes;
+    // current segment
+    size_t segment;
+    int segmentFd;
+    char* mapping;
+    size_t used;
+
+    std::shared_ptr<LogWriter> dictionary;
+    NameTable strings;
+    // the number of strings in the dictionary, the next id
+    uint32_t stringCount;
+
+    BinaryLog(std::string directory, size_t segmentBytes);
+
+    Result<> loadDictionary();
+    Result<> openSegment(size_t index);
+    void closeSegment();
+    Result<uint32_t> intern(std::string_view str);
+
+public:
+    BinaryLog(const BinaryLog&) = delete;
+    BinaryLog& operator=(const BinaryLog&) = delete;
+
+    ~BinaryLog();
+
+    // Creates the directory if needed, or continues the log in it.
+    static Result<std::unique_ptr<BinaryLog>> create(
+        const std::string& directory,
+        size_t segmentBytes = 64 << 20);
+
+    Result<> append(const LogEntry& entry) override;
+    Result<> flush() override;
+    Result<> sync() override;
+};
+
+// Calls callback with every entry of the binary log in directory, oldest
+// first.
+Result<> readBinaryLog(
+    const std::string& directory,
+    const std::function<Result<>(const LogEntry&)>& callback);
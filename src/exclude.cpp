@@ -0,0 +1,130 @@
+#include <exclude.hpp>
+
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+// a watch rule has its path, permission and key fields besides exclusions
+constexpr size_t watchRuleFields = 3;
+
+bool matchFrom(std::string_view pattern, std::string_view path)
+{
+    size_t p = 0;
+    size_t s = 0;
+    while (p < pattern.size()) {
+        char c = pattern[p];
+        if (c == '*') {
+            bool crossesDirs = p + 1 < pattern.size() && pattern[p + 1] == '*';
+            auto rest = pattern.substr(p + (crossesDirs ? 2 : 1));
+            // try every possible length of the part matched by the star
+            for (size_t end = s;; ++end) {
+                if (matchFrom(rest, path.substr(end))) {
+                    return true;
+                }
+                if (end == path.size() || (!crossesDirs && path[end] == '/')) {
+                    return false;
+                }
+            }
+        }
+        if (s == path.size() || (c == '?' ? path[s] == '/' : c != path[s])) {
+            return false;
+        }
+        ++p;
+        ++s;
+    }
+    // the rest of the path is under the matched directory
+    return s == path.size() || path[s] == '/';
+}
+
+}
+
+bool matchGlob(std::string_view pattern, std::string_view path)
+{
+    // cheap check of the part before the first wildcard
+    size_t literal = std::min(pattern.find_first_of("*?"), pattern.size());
+    if (path.compare(0, literal, pattern, 0, literal) != 0) {
+        return false;
+    }
+    return matchFrom(pattern, path);
+}
+
+Result<Exclusions> Exclusions::create(const Config& config)
+{
+    Exclusions res;
+    // dirwatch's own accesses, e.g. to its log under a watched directory
+    res.ruleFields.push_back("pid!=" + std::to_string(getpid()));
+    for (auto uid : config.excludeUids) {
+        res.ruleFields.push_back("uid!=" + std::to_string(uid));
+    }
+    for (auto auid : config.excludeAuids) {
+        res.ruleFields.push_back("auid!=" + std::to_string(auid));
+    }
+    if (config.excludeExes.size() == 1) {
+        res.ruleFields.push_back("exe!=" + config.excludeExes.front());
+    } else {
+        res.exes = config.excludeExes;
+    }
+    if (res.ruleFields.size() + watchRuleFields > AUDIT_MAX_FIELDS) {
+        return ERROR("too many excluded uids and auids for an audit rule");
+    }
+
+    for (const auto& pattern : config.excludePaths) {
+        if (pattern.empty()) {
+            return ERROR("empty excludePaths pattern");
+        }
+        if (pattern.find('/') == std::string::npos) {
+            res.namePatterns.push_back(pattern);
+        } else if (pattern.front() == '/') {
+            res.absolutePatterns.push_back(pattern);
+        } else {
+            return ERROR("excludePaths pattern " + pattern +
+                         " must be absolute or a name without '/'");
+        }
+    }
+    return std::move(res);
+}
+
+Result<> Exclusions::addRuleFields(audit_rule_data** rule) const
+{
+    std::string pair;
+    for (const auto& field : this->ruleFields) {
+        // libaudit cuts up the string it's given
+        pair = field;
+        RETURN_IF_C_ERROR(
+            audit_rule_fieldpair_data(rule, pair.data(), AUDIT_FILTER_EXIT));
+    }
+    return NO_ERROR;
+}
+
+bool Exclusions::excludesPath(std::string_view path) const
+{
+    for (const auto& pattern : this->absolutePatterns) {
+        if (matchGlob(pattern, path)) {
+            return true;
+        }
+    }
+    if (this->namePatterns.empty()) {
+        return false;
+    }
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t start = pos + (path[pos] == '/' ? 1 : 0);
+        size_t end = std::min(path.find('/', start), path.size());
+        auto name = path.substr(start, end - start);
+        for (const auto& pattern : this->namePatterns) {
+            if (matchGlob(pattern, name)) {
+                return true;
+            }
+        }
+        pos = end;
+    }
+    return false;
+}
+
+bool Exclusions::excludesExe(std::string_view exe) const
+{
+    return std::find(this->exes.begin(), this->exes.end(), exe) !=
+           this->exes.end();
+}
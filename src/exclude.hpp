@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libaudit.h>
+
+#include <config.hpp>
+#include <util.hpp>
+
+// Accesses that are not logged, from the exclude* settings, and dirwatch's
+// own. As much as possible is left to the kernel, so that the events aren't
+// generated at all: excluded uids, auids, dirwatch's pid and, if there's only
+// one, the excluded executable become fields of every watch rule. The rest
+// has to be matched in userspace: further executables, since a rule can only
+// have one exe field, and path globs. Excluded paths get no rules of their
+// own, but accesses to them can still be reported through the rule of their
+// directory or of a recursive watch.
+class Exclusions
+{
+    // rule fields, e.g. "uid!=0"
+    std::vector<std::string> ruleFields;
+    // executables not covered by the rules
+    std::vector<std::string> exes;
+    std::vector<std::string> absolutePatterns;
+    // patterns without a '/', matched against each path component
+    std::vector<std::string> namePatterns;
+
+public:
+    static Result<Exclusions> create(const Config& config);
+
+    // Adds the rule fields to a watch rule. They have to be added the same way
+    // when the rule is deleted.
+    Result<> addRuleFields(audit_rule_data** rule) const;
+
+    // true if path, or a directory it's in, is excluded
+    bool excludesPath(std::string_view path) const;
+
+    // whether the exe field of an event needs checking at all
+    bool hasExes() const { return !this->exes.empty(); }
+
+    bool excludesExe(std::string_view exe) const;
+};
+
+// Matches path against a glob. "*" matches any part of a path component,
+// "?" a single character other than '/', "**" anything, including '/'. A
+// pattern also matches every path under the one it matches.
+bool matchGlob(std::string_view pattern, std::string_view path);
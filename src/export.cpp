@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+#include <iostream>
+#include <string>
+
+#include <eventlog.hpp>
+#include <util.hpp>
+
+// Converts a binary log written with "logFormat": "binary" to the text format
+// on stdout.
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::cerr << "usage: dirwatch-export LOG_DIRECTORY" << std::endl;
+        return 1;
+    }
+
+    static char buffer[1 << 20];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    std::string line;
+    auto res = readBinaryLog(argv[1], [&](const LogEntry& entry) -> Result<> {
+        formatLogLine(entry, line);
+        if (fwrite(line.data(), 1, line.size(), stdout) != line.size()) {
+            return ERROR("can't write output");
+        }
+        return NO_ERROR;
+    });
+    if (fflush(stdout) != 0 && !res.isError()) {
+        res = ERROR("can't write output");
+    }
+    if (res.isError()) {
+        std::cerr << std::get<0>(res).message << std::endl;
+        return 1;
+    }
+    return 0;
+}
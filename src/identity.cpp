@@ -0,0 +1,93 @@
+#include <identity.hpp>
+
+#include <algorithm>
+#include <pwd.h>
+#include <sys/stat.h>
+
+namespace {
+
+// files whose change may change the result of getpwuid
+const char* const nssFiles[] = { "/etc/passwd",
+                                 "/etc/nsswitch.conf",
+                                 "/var/lib/sss/mc/passwd" };
+
+constexpr auto fileCheckInterval = std::chrono::seconds(1);
+
+// how long a uid without a user is remembered
+constexpr auto negativeTtl = std::chrono::seconds(60);
+
+timespec modificationTime(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+        return timespec{ 0, 0 };
+    }
+    return st.st_mtim;
+}
+
+}
+
+UserCache::UserCache(size_t maxEntries, std::chrono::seconds ttl)
+    : maxEntries(maxEntries)
+    , ttl(ttl)
+    , nextFileCheck(std::chrono::steady_clock::now() + fileCheckInterval)
+{
+    for (const auto path : nssFiles) {
+        this->watchedFiles.emplace_back(path, modificationTime(path));
+    }
+}
+
+bool UserCache::filesChanged()
+{
+    bool changed = false;
+    for (auto& [path, mtime] : this->watchedFiles) {
+        auto current = modificationTime(path);
+        if (current.tv_sec != mtime.tv_sec ||
+            current.tv_nsec != mtime.tv_nsec) {
+            mtime = current;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+const std::string& UserCache::lookup(uid_t uid)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now >= this->nextFileCheck) {
+        this->nextFileCheck = now + fileCheckInterval;
+        if (this->filesChanged()) {
+            this->entries.clear();
+        }
+    }
+
+    auto it = this->entries.find(uid);
+    if (it != this->entries.end() && it->second.expires > now) {
+        return it->second.name;
+    }
+
+    passwd pwd;
+    passwd* found = nullptr;
+    char buf[1024];
+    getpwuid_r(uid, &pwd, buf, sizeof(buf), &found);
+
+    Entry entry;
+    if (found == nullptr) {
+        entry.name = std::to_string(uid);
+        entry.expires =
+            now + std::min<std::chrono::seconds>(negativeTtl, this->ttl);
+    } else {
+        entry.name = found->pw_name;
+        entry.expires = now + this->ttl;
+    }
+
+    if (it != this->entries.end()) {
+        it->second = std::move(entry);
+        return it->second.name;
+    }
+    if (this->entries.size() >= this->maxEntries) {
+        // an arbitrary entry, the cache is meant to be large enough anyway
+        this->entries.erase(this->entries.begin());
+    }
+    return this->entries.emplace(uid, std::move(entry)).first->second.name;
+}
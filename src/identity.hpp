@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// uid -> user name cache in front of NSS, which can be slow when it's backed
+// by LDAP/SSSD. Unknown uids are cached too, for a shorter time. Entries
+// expire after a TTL, and the whole cache is dropped when one of the files
+// behind NSS changes (checked at most once a second).
+class UserCache
+{
+    struct Entry
+    {
+        std::string name;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    size_t maxEntries;
+    std::chrono::seconds ttl;
+    std::unordered_map<uid_t, Entry> entries;
+
+    std::chrono::steady_clock::time_point nextFileCheck;
+    std::vector<std::pair<std::string, timespec>> watchedFiles;
+
+    bool filesChanged();
+
+public:
+    UserCache(size_t maxEntries, std::chrono::seconds ttl);
+
+    // returns the user name, or the uid as a string if there's no such user
+    const std::string& lookup(uid_t uid);
+};
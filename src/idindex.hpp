@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Mixes the bits of a key so that the low bits make a good table index.
+inline size_t mixHash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+// Open addressing hash set of 32 bit ids whose keys are stored elsewhere.
+// Only the ids are kept in the table; the caller supplies the hashes, and
+// compares keys in find(). Uses linear probing with backward shift deletion,
+// so there are no tombstones.
+class IdIndex
+{
+    // id + 1, 0 for empty slots
+    std::vector<uint32_t> slots;
+    size_t count = 0;
+
+    size_t mask() const { return this->slots.size() - 1; }
+
+    void place(uint32_t id, size_t hash)
+    {
+        size_t i = hash & this->mask();
+        while (this->slots[i] != 0) {
+            i = (i + 1) & this->mask();
+        }
+        this->slots[i] = id + 1;
+    }
+
+    template<class HashOf>
+    void grow(HashOf& hashOf)
+    {
+        std::vector<uint32_t> old(this->slots.empty() ? 16
+                                                      : this->slots.size() * 2);
+        old.swap(this->slots);
+        for (auto slot : old) {
+            if (slot != 0) {
+                this->place(slot - 1, hashOf(slot - 1));
+            }
+        }
+    }
+
+public:
+    // match(id) tells whether the id has the key that hash was computed from
+    template<class Match>
+    std::optional<uint32_t> find(size_t hash, Match&& match) const
+    {
+        if (this->slots.empty()) {
+            return std::nullopt;
+        }
+        for (size_t i = hash & this->mask(); this->slots[i] != 0;
+             i = (i + 1) & this->mask()) {
+            if (match(this->slots[i] - 1)) {
+                return this->slots[i] - 1;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // hashOf(id) returns the hash of any id in the table
+    template<class HashOf>
+    void insert(uint32_t id, HashOf&& hashOf)
+    {
+        if ((this->count + 1) * 2 > this->slots.size()) {
+            this->grow(hashOf);
+        }
+        this->place(id, hashOf(id));
+        this->count++;
+    }
+
+    // The id must be in the table.
+    template<class HashOf>
+    void erase(uint32_t id, HashOf&& hashOf)
+    {
+        size_t i = hashOf(id) & this->mask();
+        while (this->slots[i] != id + 1) {
+            i = (i + 1) & this->mask();
+        }
+        // move back later entries that can't be found past the hole anymore
+        for (size_t j = (i + 1) & this->mask(); this->slots[j] != 0;
+             j = (j + 1) & this->mask()) {
+            size_t home = hashOf(this->slots[j] - 1) & this->mask();
+            bool reachable = i < j ? (home > i && home <= j)
+                                   : (home > i || home <= j);
+            if (!reachable) {
+                this->slots[i] = this->slots[j];
+                i = j;
+            }
+        }
+        this->slots[i] = 0;
+        this->count--;
+    }
+
+    size_t size() const { return this->count; }
+
+    size_t bytes() const { return this->slots.capacity() * sizeof(uint32_t); }
+};
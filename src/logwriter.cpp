@@ -0,0 +1,107 @@
+#include <logwriter.hpp>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+constexpr size_t bufferAlignment = 4096;
+}
+
+LogWriter::LogWriter(int fd, char* buffer, size_t capacity)
+    : fd(fd)
+    , buffer(buffer)
+    , capacity(capacity)
+    , used(0)
+    , dirty(false)
+{}
+
+LogWriter::~LogWriter()
+{
+    if (auto res = this->flush(); res.isError()) {
+        LOG << std::get<0>(res).message << std::endl;
+    }
+    close(this->fd);
+    free(this->buffer);
+}
+
+Result<std::shared_ptr<LogWriter>> LogWriter::create(const std::string& path,
+                                                     size_t bufferSize)
+{
+    size_t capacity =
+        std::max(bufferSize + bufferAlignment - 1, bufferAlignment) /
+        bufferAlignment * bufferAlignment;
+    void* buffer;
+    if (int err = posix_memalign(&buffer, bufferAlignment, capacity);
+        err != 0) {
+        return ERROR(strerror(err));
+    }
+    int fd =
+        open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        free(buffer);
+        return ERROR("can't open output file: " + std::string(strerror(errno)));
+    }
+    return std::shared_ptr<LogWriter>(
+        new LogWriter(fd, static_cast<char*>(buffer), capacity));
+}
+
+Result<> LogWriter::writeAll(const char* data, size_t size)
+{
+    while (size > 0) {
+        auto written = write(this->fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR(strerror(errno));
+        }
+        data += written;
+        size -= written;
+    }
+    this->dirty = true;
+    return NO_ERROR;
+}
+
+Result<> LogWriter::append(std::string_view data)
+{
+    if (this->used + data.size() > this->capacity) {
+        RETURN_IF_ERROR(this->flush());
+    }
+    if (data.size() > this->capacity) {
+        return this->writeAll(data.data(), data.size());
+    }
+    memcpy(this->buffer + this->used, data.data(), data.size());
+    this->used += data.size();
+    if (this->used == this->capacity) {
+        RETURN_IF_ERROR(this->flush());
+    }
+    return NO_ERROR;
+}
+
+Result<> LogWriter::flush()
+{
+    if (this->used == 0) {
+        return NO_ERROR;
+    }
+    // drop the buffer even on error, retrying a broken write would only make
+    // the buffer grow stale
+    size_t size = this->used;
+    this->used = 0;
+    return this->writeAll(this->buffer, size);
+}
+
+Result<> LogWriter::sync()
+{
+    RETURN_IF_ERROR(this->flush());
+    if (!this->dirty) {
+        return NO_ERROR;
+    }
+    this->dirty = false;
+    RETURN_IF_C_ERROR(fdatasync(this->fd));
+    return NO_ERROR;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <util.hpp>
+
+// Appends to a file through a large page aligned buffer. Data is only written
+// when the buffer fills up or flush() is called; the owner decides when to
+// flush and sync based on time.
+class LogWriter
+{
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t used;
+    // true if there were writes since the last sync()
+    bool dirty;
+
+    LogWriter(int fd, char* buffer, size_t capacity);
+
+    Result<> writeAll(const char* data, size_t size);
+
+public:
+    LogWriter(const LogWriter&) = delete;
+    LogWriter& operator=(const LogWriter&) = delete;
+
+    // flushes pending data
+    ~LogWriter();
+
+    static Result<std::shared_ptr<LogWriter>> create(const std::string& path,
+                                                     size_t bufferSize);
+
+    Result<> append(std::string_view data);
+
+    // writes the buffered data to the file
+    Result<> flush();
+
+    // flushes, then fdatasyncs if anything was written since the last sync
+    Result<> sync();
+
+    size_t pending() const { return this->used; }
+};
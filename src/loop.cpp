@@ -0,0 +1,169 @@
+#include <loop.hpp>
+
+#include <errno.h>
+#include <iostream>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+Notifier::Notifier(int fd)
+    : fd(fd)
+{}
+
+Notifier::~Notifier()
+{
+    close(this->fd);
+}
+
+Result<std::shared_ptr<Notifier>> Notifier::create()
+{
+    RETURN_OR_SET_C(int fd, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    return std::shared_ptr<Notifier>(new Notifier(fd));
+}
+
+void Notifier::notify()
+{
+    uint64_t one = 1;
+    // can only fail if the counter is about to overflow, which still wakes
+    // up the reader
+    (void)!write(this->fd, &one, sizeof(one));
+}
+
+void Notifier::clear()
+{
+    uint64_t count;
+    (void)!read(this->fd, &count, sizeof(count));
+}
+
+EventLoop::EventLoop(int epollFd, std::shared_ptr<Notifier> wakeup)
+    : epollFd(epollFd)
+    , running(true)
+    , wakeup(std::move(wakeup))
+{}
+
+EventLoop::~EventLoop()
+{
+    for (const auto& source : this->sources) {
+        if (source->ownsFd) {
+            close(source->fd);
+        }
+    }
+    close(this->epollFd);
+}
+
+Result<std::shared_ptr<EventLoop>> EventLoop::create()
+{
+    RETURN_OR_SET(auto wakeup, Notifier::create());
+    RETURN_OR_SET_C(int fd, epoll_create1(EPOLL_CLOEXEC));
+    auto loop = std::shared_ptr<EventLoop>(new EventLoop(fd, wakeup));
+    RETURN_IF_ERROR(loop->watchFd(wakeup->getFd(), [wakeup]() {
+        wakeup->clear();
+        return Result<>(NO_ERROR);
+    }));
+    return std::move(loop);
+}
+
+Result<> EventLoop::addSource(int fd, bool ownsFd, Callback callback)
+{
+    auto source = std::make_unique<Source>(Source{ fd, ownsFd, callback });
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = source.get();
+    if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        auto err = ERROR(strerror(errno));
+        if (ownsFd) {
+            close(fd);
+        }
+        return err;
+    }
+
+    this->sources.push_back(std::move(source));
+    return NO_ERROR;
+}
+
+Result<> EventLoop::watchFd(int fd, Callback callback)
+{
+    return this->addSource(fd, false /*ownsFd*/, std::move(callback));
+}
+
+Result<> EventLoop::handleSignals(std::initializer_list<int> signals,
+                                  std::function<Result<>(int)> callback)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int sig : signals) {
+        sigaddset(&mask, sig);
+    }
+    if (int err = pthread_sigmask(SIG_BLOCK, &mask, nullptr); err != 0) {
+        return ERROR(strerror(err));
+    }
+    RETURN_OR_SET_C(int fd, signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+
+    return this->addSource(fd, true /*ownsFd*/, [fd, callback]() -> Result<> {
+        signalfd_siginfo info;
+        while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+            RETURN_IF_ERROR(callback(info.ssi_signo));
+        }
+        return NO_ERROR;
+    });
+}
+
+Result<> EventLoop::addTimer(std::chrono::milliseconds interval,
+                             Callback callback)
+{
+    RETURN_OR_SET_C(
+        int fd, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+
+    itimerspec spec;
+    spec.it_interval.tv_sec = interval.count() / 1000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, nullptr) < 0) {
+        auto err = ERROR(strerror(errno));
+        close(fd);
+        return err;
+    }
+
+    return this->addSource(fd, true /*ownsFd*/, [fd, callback]() -> Result<> {
+        uint64_t expirations;
+        if (read(fd, &expirations, sizeof(expirations)) < 0) {
+            return NO_ERROR;
+        }
+        return callback();
+    });
+}
+
+Result<> EventLoop::run()
+{
+    constexpr int maxEvents = 16;
+    epoll_event events[maxEvents];
+
+    while (this->running) {
+        int count = epoll_wait(this->epollFd, events, maxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR(strerror(errno));
+        }
+        for (int i = 0; i < count && this->running; ++i) {
+            auto source = static_cast<Source*>(events[i].data.ptr);
+            if (auto res = source->callback(); res.isError()) {
+                LOG << std::get<0>(res).message << std::endl;
+            }
+        }
+    }
+    return NO_ERROR;
+}
+
+void EventLoop::stop()
+{
+    this->running = false;
+    this->wakeup->notify();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include <util.hpp>
+
+// Wakes up an event loop from another thread, through an eventfd.
+class Notifier
+{
+    int fd;
+
+    Notifier(int fd);
+
+public:
+    Notifier(const Notifier&) = delete;
+    Notifier& operator=(const Notifier&) = delete;
+
+    ~Notifier();
+
+    static Result<std::shared_ptr<Notifier>> create();
+
+    int getFd() const { return this->fd; }
+
+    void notify();
+
+    // resets the notification, call before checking for new work
+    void clear();
+};
+
+// epoll based event loop. Besides plain file descriptors it handles signals
+// (through a signalfd) and periodic timers (through timerfds), so that all of
+// them are dispatched from the same thread.
+class EventLoop
+{
+public:
+    using Callback = std::function<Result<>()>;
+
+private:
+    struct Source
+    {
+        int fd;
+        bool ownsFd;
+        Callback callback;
+    };
+
+    int epollFd;
+    std::atomic<bool> running;
+    std::shared_ptr<Notifier> wakeup;
+    std::vector<std::unique_ptr<Source>> sources;
+
+    EventLoop(int epollFd, std::shared_ptr<Notifier> wakeup);
+
+    Result<> addSource(int fd, bool ownsFd, Callback callback);
+
+public:
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    ~EventLoop();
+
+    static Result<std::shared_ptr<EventLoop>> create();
+
+    // Calls callback whenever fd becomes readable. The fd is not closed by the
+    // loop.
+    Result<> watchFd(int fd, Callback callback);
+
+    // Blocks the given signals for the calling thread and delivers them
+    // through the loop instead. Threads started afterwards inherit the mask.
+    Result<> handleSignals(std::initializer_list<int> signals,
+                           std::function<Result<>(int)> callback);
+
+    // Calls callback every interval, starting one interval from now.
+    Result<> addTimer(std::chrono::milliseconds interval, Callback callback);
+
+    // Dispatches events until stop() is called. Errors returned by callbacks
+    // are logged, they don't stop the loop. A stopped loop can't be run again.
+    Result<> run();
+
+    // can be called from any thread
+    void stop();
+};
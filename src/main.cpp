@@ -10,46 +10,161 @@
 #include <string>
 #include <iostream>
 
+#include <backlog.hpp>
 #include <config.hpp>
 #include <event.hpp>
+#include <loop.hpp>
+#include <metrics.hpp>
+#include <pipeline.hpp>
+#include <rules.hpp>
+#include <source.hpp>
 #include <util.hpp>
 
-std::shared_ptr<EventHandler> eventHandler;
-
-void sigHandler(int)
-{
-    eventHandler.reset();
-    exit(0);
+namespace {
+// how often the pipeline queues are checked for backpressure
+constexpr auto backpressureInterval = std::chrono::seconds(10);
+// how often the kernel's audit status is checked
+constexpr auto backlogInterval = std::chrono::seconds(1);
 }
 
-Result<> doStuff()
+// Runs standalone, receiving events from the kernel, or as an auditd plugin
+// (plugin = true), reading them from stdin. Rules are managed by dirwatch
+// either way. With debug, every record received is echoed to stdout.
+Result<> doStuff(bool plugin, bool debug)
 {
+    RETURN_OR_SET(auto loop, EventLoop::create());
+    // auditd sends SIGHUP to its plugins when its config is reloaded
+    RETURN_IF_ERROR(
+        loop->handleSignals({ SIGTERM, SIGINT, SIGHUP }, [&](int sig) {
+            if (sig != SIGHUP) {
+                loop->stop();
+            }
+            return Result<>(NO_ERROR);
+        }));
+
     RETURN_OR_SET(auto config, readConfig());
-    RETURN_OR_SET_C(auto fd, audit_open());
-    ScopeGuard closeAudit([&]() { audit_close(fd); });
 
-    RETURN_OR_SET(eventHandler, EventHandler::create(fd, config));
+    // Rules are managed through a socket of their own, so the reader thread
+    // never sees the rule ACKs meant for the writer.
+    RETURN_OR_SET_C(auto ruleFd, audit_open());
+    ScopeGuard closeRuleFd([&]() { audit_close(ruleFd); });
+
+    RETURN_OR_SET(auto eventHandler,
+                  EventHandler::create(std::make_unique<AuditRuleSink>(ruleFd),
+                                       config));
     ScopeGuard deleteEH([&]() { eventHandler.reset(); });
-    signal(SIGTERM, &sigHandler);
-    signal(SIGINT, &sigHandler);
 
-    RETURN_IF_C_ERROR(audit_set_pid(fd, getpid(), WAIT_YES));
-    RETURN_IF_C_ERROR(audit_set_enabled(fd, 1));
+    int eventFd = -1;
+    ScopeGuard closeEventFd([&]() {
+        if (eventFd >= 0) {
+            audit_close(eventFd);
+        }
+    });
+    std::unique_ptr<EventSource> input;
+    StreamSource* stdinSource = nullptr;
+    if (plugin) {
+        RETURN_OR_SET(auto stream, StreamSource::create(STDIN_FILENO));
+        stdinSource = stream.get();
+        input = std::move(stream);
+    } else {
+        RETURN_OR_SET_C(eventFd, audit_open());
+        input = std::make_unique<NetlinkSource>(eventFd);
+    }
+
+    std::shared_ptr<EventSource> source;
+    if (config.recordPath.empty()) {
+        source = std::move(input);
+    } else {
+        RETURN_OR_SET(
+            auto recorder,
+            RecordingSource::create(std::move(input), config.recordPath));
+        std::shared_ptr<RecordingSource> shared = std::move(recorder);
+        RETURN_IF_ERROR(loop->addTimer(
+            std::chrono::milliseconds(config.flushIntervalMs),
+            [shared]() { return shared->flush(); }));
+        source = shared;
+    }
 
-    while (true) {
-        if (auto res = eventHandler->nextRecord(); res.isError()) {
-            LOG << std::get<0>(res).message << std::endl;
+    // The kernel's status is asked for on yet another socket, as replies on
+    // the rule socket could be mistaken for rule ACKs. The metrics server's
+    // thread has one of its own.
+    RETURN_OR_SET_C(auto statusFd, audit_open());
+    ScopeGuard closeStatusFd([&]() { audit_close(statusFd); });
+    int metricsStatusFd = -1;
+    ScopeGuard closeMetricsStatusFd([&]() {
+        if (metricsStatusFd >= 0) {
+            audit_close(metricsStatusFd);
         }
+    });
+    std::unique_ptr<Metrics> metrics;
+    Pipeline::Observer observer;
+    if (!config.metricsSocket.empty()) {
+        RETURN_OR_SET_C(metricsStatusFd, audit_open());
+        metrics = std::make_unique<Metrics>(metricsStatusFd);
+        observer = [&metrics](const Event& event) {
+            metrics->observeEvent(event);
+        };
     }
 
+    RETURN_OR_SET(auto pipeline,
+                  Pipeline::create(source, eventHandler, config, observer));
+    ScopeGuard deletePipeline([&]() { pipeline.reset(); });
+    pipeline->setEchoRecords(debug);
+
+    std::unique_ptr<MetricsServer> metricsServer;
+    if (metrics) {
+        RETURN_OR_SET(metricsServer,
+                      MetricsServer::create(config.metricsSocket, [&]() {
+                          return metrics->render(*pipeline, *eventHandler);
+                      }));
+    }
+
+    // as a plugin, auditd owns the kernel's settings
+    RETURN_OR_SET(auto backlog,
+                  BacklogControl::create(plugin ? -1 : statusFd, config));
+
+    if (!plugin) {
+        RETURN_IF_C_ERROR(audit_set_pid(eventFd, getpid(), WAIT_YES));
+        RETURN_IF_C_ERROR(audit_set_enabled(eventFd, 1));
+    }
+
+    RETURN_IF_ERROR(loop->watchFd(source->getFd(), [&]() -> Result<> {
+        RETURN_IF_ERROR(pipeline->readRecords());
+        // auditd closes the pipe when it stops
+        if (stdinSource != nullptr && stdinSource->isClosed()) {
+            loop->stop();
+        }
+        return Result<>(NO_ERROR);
+    }));
+    RETURN_IF_ERROR(loop->addTimer(backpressureInterval, [&]() {
+        pipeline->reportBackpressure();
+        return Result<>(NO_ERROR);
+    }));
+    RETURN_IF_ERROR(loop->addTimer(
+        backlogInterval, [&]() { return backlog->update(*pipeline); }));
+    RETURN_IF_ERROR(loop->run());
+
     return NO_ERROR;
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    if (auto res = doStuff(); res.isError()) {
+    bool plugin = false;
+    bool debug = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--plugin") {
+            plugin = true;
+        } else if (arg == "--debug") {
+            debug = true;
+        } else {
+            LOG << "usage: dirwatch [--plugin] [--debug]" << std::endl;
+            return 1;
+        }
+    }
+    if (auto res = doStuff(plugin, debug); res.isError()) {
         LOG << std::get<0>(res).message << std::endl;
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,413 @@
+#include <metrics.hpp>
+
+#include <chrono>
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+// how long the kernel may take to answer a status request
+constexpr int statusTimeoutMs = 1000;
+
+// how long a client may take to read the page
+constexpr auto clientTimeout = std::chrono::seconds(1);
+
+constexpr double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+std::string formatValue(double value)
+{
+    if (value >= 0 && value < 1e15 && value == uint64_t(value)) {
+        return std::to_string(uint64_t(value));
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", value);
+    return buf;
+}
+
+}
+
+Histogram::Histogram()
+    : count(0)
+    , sum(0)
+{
+    for (auto& bucket : this->buckets) {
+        bucket = 0;
+    }
+}
+
+size_t Histogram::bucketOf(uint64_t value)
+{
+    if (value < (uint64_t(1) << subBucketBits)) {
+        return value;
+    }
+    // the highest bit picks the range, the next ones the bucket in it
+    unsigned shift = 63 - __builtin_clzll(value) - subBucketBits;
+    return (size_t(shift + 1) << subBucketBits) +
+           ((value >> shift) & ((uint64_t(1) << subBucketBits) - 1));
+}
+
+uint64_t Histogram::bucketLimit(size_t bucket)
+{
+    if (bucket < (size_t(1) << subBucketBits)) {
+        return bucket;
+    }
+    unsigned shift = (bucket >> subBucketBits) - 1;
+    uint64_t low = ((uint64_t(1) << subBucketBits) +
+                    (bucket & ((size_t(1) << subBucketBits) - 1)))
+                   << shift;
+    return low + ((uint64_t(1) << shift) - 1);
+}
+
+void Histogram::record(uint64_t value)
+{
+    this->buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    this->count.fetch_add(1, std::memory_order_relaxed);
+    this->sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::quantile(double q) const
+{
+    // the buckets may change meanwhile, so the total is taken from the same
+    // loads as the counts
+    uint64_t counts[bucketCount];
+    uint64_t total = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        counts[i] = this->buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(q * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketLimit(i);
+        }
+    }
+    return bucketLimit(bucketCount - 1);
+}
+
+uint64_t Histogram::total() const
+{
+    return this->count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::totalValue() const
+{
+    return this->sum.load(std::memory_order_relaxed);
+}
+
+void MetricsPage::metric(std::string_view name,
+                         std::string_view type,
+                         std::string_view help)
+{
+    this->text.append("# HELP ").append(name).append(" ").append(help);
+    this->text.append("\n# TYPE ").append(name).append(" ").append(type);
+    this->text.append("\n");
+}
+
+void MetricsPage::sample(std::string_view name,
+                         double value,
+                         std::string_view labels)
+{
+    this->text.append(name);
+    if (!labels.empty()) {
+        this->text.append("{").append(labels).append("}");
+    }
+    this->text.append(" ").append(formatValue(value)).append("\n");
+}
+
+void MetricsPage::summary(std::string_view name,
+                          std::string_view help,
+                          const Histogram& histogram,
+                          double scale)
+{
+    this->metric(name, "summary", help);
+    for (double q : quantiles) {
+        this->sample(name,
+                     histogram.quantile(q) * scale,
+                     "quantile=\"" + formatValue(q) + "\"");
+    }
+    this->sample(std::string(name) + "_sum", histogram.totalValue() * scale);
+    this->sample(std::string(name) + "_count", histogram.total());
+}
+
+Result<audit_status> requestAuditStatus(int fd)
+{
+    RETURN_IF_C_ERROR(audit_request_status(fd));
+    audit_reply reply;
+    while (true) {
+        pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, statusTimeoutMs);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        RETURN_IF_C_ERROR(ready);
+        if (ready == 0) {
+            return ERROR("no audit status from the kernel");
+        }
+        int len = audit_get_reply(fd, &reply, GET_REPLY_NONBLOCKING, 0);
+        if (len <= 0) {
+            continue;
+        }
+        if (reply.type == AUDIT_GET) {
+            audit_status status;
+            memcpy(&status, reply.status, sizeof(status));
+            return status;
+        }
+        if (reply.type == NLMSG_ERROR && reply.error->error != 0) {
+            return ERROR(strerror(-reply.error->error));
+        }
+    }
+}
+
+Metrics::Metrics(int statusFd)
+    : statusFd(statusFd)
+{}
+
+void Metrics::observeEvent(const Event& event)
+{
+    // events that didn't match a watch rule aren't logged
+    if (!event.shouldProcess()) {
+        return;
+    }
+    const auto& timing = event.getTiming();
+    this->pipelineLatency.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(timing.processed -
+                                                              timing.read)
+            .count());
+
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+                   .count();
+    auto logged =
+        event.getTimestamp() * 1000000L + event.getMilliseconds() * 1000L;
+    // the clock may have been set back since
+    if (now >= logged) {
+        this->eventLatency.record(now - logged);
+    }
+}
+
+std::string Metrics::render(const Pipeline& pipeline,
+                            const EventHandler& handler) const
+{
+    MetricsPage page;
+
+    auto records = pipeline.recordStats();
+    page.metric("dirwatch_records_total",
+                "counter",
+                "Audit records received, by type.");
+    for (const auto& [type, count] : records.received) {
+        auto name = audit_msg_type_to_name(type);
+        page.sample("dirwatch_records_total",
+                    count,
+                    "type=\"" +
+                        (name ? std::string(name) : std::to_string(type)) +
+                        "\"");
+    }
+    page.metric("dirwatch_parse_failures_total",
+                "counter",
+                "Audit records that couldn't be parsed.");
+    page.sample("dirwatch_parse_failures_total", records.parseFailures);
+
+    auto assembler = pipeline.assemblerStats();
+    page.metric("dirwatch_pending_events",
+                "gauge",
+                "Events waiting for the rest of their records.");
+    page.sample("dirwatch_pending_events", assembler.pending);
+    page.metric("dirwatch_dropped_events_total",
+                "counter",
+                "Events dropped: incomplete ones, or reads shed under load.");
+    page.sample("dirwatch_dropped_events_total",
+                assembler.timedOut,
+                "reason=\"timeout\"");
+    page.sample("dirwatch_dropped_events_total",
+                assembler.evicted,
+                "reason=\"full\"");
+    page.sample("dirwatch_dropped_events_total",
+                pipeline.shedCount(),
+                "reason=\"shed\"");
+    page.metric("dirwatch_shedding_reads",
+                "gauge",
+                "1 while read events are dropped to keep up.");
+    page.sample("dirwatch_shedding_reads", pipeline.shedsReads() ? 1 : 0);
+
+    auto queues = pipeline.queueStats();
+    page.metric("dirwatch_queue_depth", "gauge", "Items in pipeline queues.");
+    for (const auto& queue : queues) {
+        page.sample("dirwatch_queue_depth",
+                    queue.depth,
+                    "stage=\"" + queue.stage + "\"");
+    }
+    page.metric("dirwatch_queue_stalls_total",
+                "counter",
+                "Times a pipeline stage waited for a full queue.");
+    for (const auto& queue : queues) {
+        page.sample("dirwatch_queue_stalls_total",
+                    queue.stalls,
+                    "stage=\"" + queue.stage + "\"");
+    }
+
+    auto watches = handler.watchStats();
+    page.metric("dirwatch_audit_rules", "gauge", "Audit rules installed.");
+    page.sample("dirwatch_audit_rules", watches.rules);
+    page.metric(
+        "dirwatch_watched_paths", "gauge", "Paths in the watch tree.");
+    page.sample("dirwatch_watched_paths", watches.paths);
+    page.metric("dirwatch_watch_tree_bytes",
+                "gauge",
+                "Memory taken by the watch tree.");
+    page.sample("dirwatch_watch_tree_bytes", watches.bytes);
+
+    auto status = requestAuditStatus(this->statusFd);
+    if (status.isError()) {
+        LOG << std::get<0>(status).message << std::endl;
+    } else {
+        const auto& kernel = std::get<1>(status);
+        page.metric("dirwatch_kernel_lost_total",
+                    "counter",
+                    "Audit records the kernel dropped.");
+        page.sample("dirwatch_kernel_lost_total", kernel.lost);
+        page.metric("dirwatch_kernel_backlog",
+                    "gauge",
+                    "Audit records queued in the kernel.");
+        page.sample("dirwatch_kernel_backlog", kernel.backlog);
+        page.metric("dirwatch_kernel_backlog_limit",
+                    "gauge",
+                    "Audit records the kernel queues at most.");
+        page.sample("dirwatch_kernel_backlog_limit", kernel.backlog_limit);
+    }
+
+    page.summary("dirwatch_event_latency_seconds",
+                 "Time from the kernel's timestamp of an event to logging it.",
+                 this->eventLatency,
+                 1e-6);
+    page.summary(
+        "dirwatch_pipeline_latency_seconds",
+        "Time from reading the last record of an event to logging it.",
+        this->pipelineLatency,
+        1e-6);
+    return page.str();
+}
+
+MetricsServer::MetricsServer(int fd,
+                             std::string path,
+                             std::function<std::string()> render)
+    : fd(fd)
+    , path(std::move(path))
+    , render(std::move(render))
+{}
+
+MetricsServer::~MetricsServer()
+{
+    if (this->thread.joinable()) {
+        this->loop->stop();
+        this->thread.join();
+    }
+    close(this->fd);
+    unlink(this->path.c_str());
+}
+
+Result<std::unique_ptr<MetricsServer>> MetricsServer::create(
+    const std::string& path,
+    std::function<std::string()> render)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return ERROR("metrics socket path too long: " + path);
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    RETURN_OR_SET_C(int fd,
+                    socket(AF_UNIX,
+                           SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                           0));
+    ScopeGuard closeFd([&]() { close(fd); });
+    // left over from an earlier run
+    unlink(path.c_str());
+    RETURN_IF_C_ERROR(
+        bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)));
+    RETURN_IF_C_ERROR(listen(fd, 16));
+
+    closeFd.disable();
+    auto server = std::unique_ptr<MetricsServer>(
+        new MetricsServer(fd, path, std::move(render)));
+    auto raw = server.get();
+    RETURN_OR_SET(server->loop, EventLoop::create());
+    RETURN_IF_ERROR(server->loop->watchFd(fd, [raw]() {
+        raw->serve();
+        return Result<>(NO_ERROR);
+    }));
+    server->thread = std::thread([raw]() {
+        if (auto res = raw->loop->run(); res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
+        }
+    });
+    return std::move(server);
+}
+
+void MetricsServer::serve()
+{
+    while (true) {
+        int client = accept4(this->fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOG << "metrics socket: " << strerror(errno) << std::endl;
+            }
+            if (errno != EINTR) {
+                return;
+            }
+            continue;
+        }
+        ScopeGuard closeClient([&]() { close(client); });
+
+        timeval timeout = { clientTimeout.count(), 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        // Whatever the request is, it gets the page, but it's read up to the
+        // empty line ending its headers first; clients may fail to send it
+        // once the socket is closed.
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos &&
+               request.size() < 16 * 1024) {
+            ssize_t res = recv(client, buf, sizeof(buf), 0);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res <= 0) {
+                break;
+            }
+            request.append(buf, res);
+        }
+
+        auto body = this->render();
+        auto response = "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " +
+                        std::to_string(body.size()) + "\r\n\r\n" + body;
+        for (size_t sent = 0; sent < response.size();) {
+            ssize_t res = send(client,
+                               response.data() + sent,
+                               response.size() - sent,
+                               MSG_NOSIGNAL);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res <= 0) {
+                break;
+            }
+            sent += res;
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <libaudit.h>
+
+#include <event.hpp>
+#include <loop.hpp>
+#include <pipeline.hpp>
+#include <util.hpp>
+
+// Histogram of non-negative integers that any thread can add to without
+// locking. As in HDR histograms, every power of two range is split into 16
+// equal buckets, so quantiles are within 1/16 of the actual values however
+// widely they are spread.
+class Histogram
+{
+    static constexpr unsigned subBucketBits = 4;
+    static constexpr size_t bucketCount = (65 - subBucketBits)
+                                          << subBucketBits;
+
+    std::atomic<uint64_t> buckets[bucketCount];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+    static size_t bucketOf(uint64_t value);
+    // the largest value counted in the bucket
+    static uint64_t bucketLimit(size_t bucket);
+
+public:
+    Histogram();
+
+    void record(uint64_t value);
+
+    // The value that fraction q of the recorded values are not above, rounded
+    // up to the limit of its bucket. 0 if nothing was recorded.
+    uint64_t quantile(double q) const;
+
+    uint64_t total() const;
+    uint64_t totalValue() const;
+};
+
+// Builds a page in the Prometheus text format.
+class MetricsPage
+{
+    std::string text;
+
+public:
+    // Starts a metric. Samples of it follow, optionally with labels, e.g.
+    // "type=\"SYSCALL\"".
+    void metric(std::string_view name,
+                std::string_view type,
+                std::string_view help);
+    void sample(std::string_view name,
+                double value,
+                std::string_view labels = {});
+
+    // A summary of the values in histogram, multiplied by scale.
+    void summary(std::string_view name,
+                 std::string_view help,
+                 const Histogram& histogram,
+                 double scale);
+
+    const std::string& str() const { return this->text; }
+};
+
+// Asks the kernel for its audit status through fd, an audit socket that
+// nothing else reads from, on any thread at the same time either.
+Result<audit_status> requestAuditStatus(int fd);
+
+// What dirwatch reports about itself. Latencies are recorded as events are
+// processed; everything else is collected from the pipeline, the event
+// handler and the kernel when the page is rendered.
+class Metrics
+{
+    // audit socket for status requests
+    int statusFd;
+    // microseconds from the kernel's timestamp to the log
+    Histogram eventLatency;
+    // microseconds from reading the last record of an event to the log
+    Histogram pipelineLatency;
+
+public:
+    Metrics(int statusFd);
+
+    // called on the writer thread with every processed event
+    void observeEvent(const Event& event);
+
+    std::string render(const Pipeline& pipeline,
+                       const EventHandler& handler) const;
+};
+
+// Serves a page over a unix socket, to every client that connects, as a
+// plain HTTP response. The request isn't looked at, so any path works, e.g.
+// curl --unix-socket PATH http://localhost/metrics
+//
+// Clients are served one at a time on a thread of its own, so a slow one
+// only holds up the others, never the reading of audit records.
+class MetricsServer
+{
+    int fd;
+    std::string path;
+    std::function<std::string()> render;
+    std::shared_ptr<EventLoop> loop;
+    std::thread thread;
+
+    MetricsServer(int fd,
+                  std::string path,
+                  std::function<std::string()> render);
+
+    void serve();
+
+public:
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // stops the thread, closes and removes the socket
+    ~MetricsServer();
+
+    // Listens on path, replacing a stale socket. render is called on the
+    // server's thread for every client.
+    static Result<std::unique_ptr<MetricsServer>> create(
+        const std::string& path,
+        std::function<std::string()> render);
+};
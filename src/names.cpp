@@ -0,0 +1,81 @@
+#include <names.hpp>
+
+#include <functional>
+
+namespace {
+
+// Don't bother compacting small pools
+constexpr size_t minCompactBytes = 64 * 1024;
+
+}
+
+size_t NameTable::hashOf(NameId id) const
+{
+    return std::hash<std::string_view>()(this->get(id));
+}
+
+NameId NameTable::acquire(std::string_view name)
+{
+    if (auto id = this->find(name)) {
+        this->entries[*id].references++;
+        return *id;
+    }
+
+    NameId id;
+    if (this->freeIds.empty()) {
+        id = this->entries.size();
+        this->entries.emplace_back();
+    } else {
+        id = this->freeIds.back();
+        this->freeIds.pop_back();
+    }
+    this->entries[id] = {
+        uint32_t(this->pool.size()), uint32_t(name.size()), 1
+    };
+    this->pool.append(name);
+    this->index.insert(id, [this](NameId i) { return this->hashOf(i); });
+    return id;
+}
+
+void NameTable::release(NameId id)
+{
+    auto& entry = this->entries[id];
+    if (--entry.references > 0) {
+        return;
+    }
+    this->index.erase(id, [this](NameId i) { return this->hashOf(i); });
+    this->freeIds.push_back(id);
+    this->garbage += entry.length;
+    if (this->garbage > minCompactBytes &&
+        this->garbage * 2 > this->pool.size()) {
+        this->compact();
+    }
+}
+
+void NameTable::compact()
+{
+    std::string live;
+    live.reserve(this->pool.size() - this->garbage);
+    for (auto& entry : this->entries) {
+        if (entry.references == 0) {
+            continue;
+        }
+        auto offset = live.size();
+        live.append(this->pool, entry.offset, entry.length);
+        entry.offset = offset;
+    }
+    this->pool = std::move(live);
+    this->garbage = 0;
+}
+
+std::optional<NameId> NameTable::find(std::string_view name) const
+{
+    return this->index.find(std::hash<std::string_view>()(name),
+                            [&](NameId id) { return this->get(id) == name; });
+}
+
+size_t NameTable::bytes() const
+{
+    return this->pool.capacity() + this->entries.capacity() * sizeof(Entry) +
+           this->freeIds.capacity() * sizeof(NameId) + this->index.bytes();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <idindex.hpp>
+
+using NameId = uint32_t;
+
+// Interned file names. Every distinct name is stored once in a shared pool
+// and referred to by id; names are reference counted and their ids reused
+// once unused. Space of released names is reclaimed by compacting the pool
+// when more than half of it is unused.
+class NameTable
+{
+    struct Entry
+    {
+        uint32_t offset;
+        uint32_t length;
+        // 0 if the id is free
+        uint32_t references;
+    };
+
+    std::string pool;
+    std::vector<Entry> entries;
+    std::vector<NameId> freeIds;
+    IdIndex index;
+    // bytes of released names still in the pool
+    size_t garbage = 0;
+
+    size_t hashOf(NameId id) const;
+    void compact();
+
+public:
+    // Interns name if needed and adds a reference to it.
+    NameId acquire(std::string_view name);
+    void release(NameId id);
+
+    std::optional<NameId> find(std::string_view name) const;
+
+    std::string_view get(NameId id) const
+    {
+        const auto& entry = this->entries[id];
+        return std::string_view(this->pool).substr(entry.offset, entry.length);
+    }
+
+    size_t bytes() const;
+};
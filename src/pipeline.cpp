@@ -0,0 +1,337 @@
+#include <pipeline.hpp>
+
+#include <chrono>
+#include <errno.h>
+#include <iostream>
+#include <string.h>
+
+namespace {
+
+// how long a producer sleeps before retrying a full queue
+constexpr auto fullQueueBackoff = std::chrono::microseconds(100);
+
+// number of records dispatched before the parser threads are woken up
+constexpr size_t batchSize = 64;
+
+}
+
+Pipeline::ParserStage::ParserStage(const Config& config)
+    : queue(config.queueCapacity)
+    , stalls(0)
+    , assembler(config)
+{}
+
+Pipeline::Pipeline(std::shared_ptr<EventSource> source,
+                   std::shared_ptr<EventHandler> handler,
+                   const Config& config,
+                   Observer observer)
+    : source(std::move(source))
+    , handler(std::move(handler))
+    , observer(std::move(observer))
+    , echoRecords(false)
+    , parseFailures(0)
+    , shedReads(false)
+    , shedEvents(0)
+    , parsersToNotify(config.parserThreads, false)
+    , events(config.queueCapacity)
+    , eventStalls(0)
+    , reportedStalls(0)
+    , reportedDrops(0)
+{
+    for (auto& count : this->recordCounts) {
+        count = 0;
+    }
+    for (size_t i = 0; i < config.parserThreads; ++i) {
+        this->parsers.push_back(
+            std::make_unique<ParserStage>(config));
+    }
+}
+
+Pipeline::~Pipeline()
+{
+    for (auto& parser : this->parsers) {
+        if (parser->thread.joinable()) {
+            parser->loop->stop();
+            parser->thread.join();
+        }
+    }
+    if (this->writerThread.joinable()) {
+        this->writerLoop->stop();
+        this->writerThread.join();
+    }
+}
+
+Result<std::shared_ptr<Pipeline>> Pipeline::create(
+    std::shared_ptr<EventSource> source,
+    std::shared_ptr<EventHandler> handler,
+    const Config& config,
+    Observer observer)
+{
+    if (config.parserThreads == 0) {
+        return ERROR("at least one parser thread is needed");
+    }
+    auto pipeline = std::shared_ptr<Pipeline>(new Pipeline(
+        std::move(source), std::move(handler), config, std::move(observer)));
+    auto raw = pipeline.get();
+
+    for (auto& parser : pipeline->parsers) {
+        auto stage = parser.get();
+        RETURN_OR_SET(stage->notifier, Notifier::create());
+        RETURN_OR_SET(stage->loop, EventLoop::create());
+        RETURN_IF_ERROR(
+            stage->loop->watchFd(stage->notifier->getFd(), [raw, stage]() {
+                stage->notifier->clear();
+                raw->parseRecords(*stage);
+                return Result<>(NO_ERROR);
+            }));
+    }
+
+    RETURN_OR_SET(pipeline->eventNotifier, Notifier::create());
+    RETURN_OR_SET(pipeline->writerLoop, EventLoop::create());
+    RETURN_IF_ERROR(pipeline->handler->addTimers(*pipeline->writerLoop));
+    RETURN_IF_ERROR(pipeline->writerLoop->watchFd(
+        pipeline->eventNotifier->getFd(), [raw]() {
+            raw->eventNotifier->clear();
+            raw->writeEvents();
+            return Result<>(NO_ERROR);
+        }));
+
+    // threads go last, so the destructor only has to deal with a fully set up
+    // pipeline
+    pipeline->writerThread = std::thread([raw]() {
+        if (auto res = raw->writerLoop->run(); res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
+        }
+        raw->writeEvents();
+    });
+    for (auto& parser : pipeline->parsers) {
+        auto stage = parser.get();
+        stage->thread = std::thread([raw, stage]() {
+            if (auto res = stage->loop->run(); res.isError()) {
+                LOG << std::get<0>(res).message << std::endl;
+            }
+            raw->parseRecords(*stage);
+        });
+    }
+
+    return std::move(pipeline);
+}
+
+Result<> Pipeline::dispatchRecord(int type, std::string_view message)
+{
+    // audit_get_reply seems to return garbage sometimes, try to filter it out
+    if (type < firstRecordType || type > lastRecordType) {
+        return NO_ERROR;
+    }
+    this->recordCounts[type - firstRecordType].fetch_add(
+        1, std::memory_order_relaxed);
+
+    if (this->echoRecords) {
+        std::cout << message << std::endl;
+    }
+
+    if (wantedFields(type) == nullptr) {
+        return NO_ERROR;
+    }
+    if (message.size() > sizeof(RawRecord::data)) {
+        return ERROR("audit message too long");
+    }
+
+    long timestamp, milliseconds, sequenceNumber;
+    auto header =
+        Record::parseHeader(message, timestamp, milliseconds, sequenceNumber);
+    if (header.isError()) {
+        this->parseFailures.fetch_add(1, std::memory_order_relaxed);
+        return std::get<0>(header);
+    }
+    size_t shard = size_t(sequenceNumber) % this->parsers.size();
+    auto& stage = *this->parsers[shard];
+
+    RawRecord* slot;
+    while ((slot = stage.queue.prepare()) == nullptr) {
+        stage.stalls++;
+        stage.notifier->notify();
+        std::this_thread::sleep_for(fullQueueBackoff);
+    }
+    slot->type = type;
+    slot->len = message.size();
+    slot->readTime = EventTiming::Clock::now();
+    memcpy(slot->data, message.data(), message.size());
+    stage.queue.commit();
+    this->parsersToNotify[shard] = true;
+
+    return NO_ERROR;
+}
+
+void Pipeline::notifyParsers()
+{
+    for (size_t i = 0; i < this->parsers.size(); ++i) {
+        if (this->parsersToNotify[i]) {
+            this->parsers[i]->notifier->notify();
+            this->parsersToNotify[i] = false;
+        }
+    }
+}
+
+Result<> Pipeline::readRecords()
+{
+    ScopeGuard notify([this]() { this->notifyParsers(); });
+    int type;
+    std::string_view message;
+    for (size_t count = 1;; ++count) {
+        RETURN_OR_SET(bool found, this->source->nextRecord(type, message));
+        if (!found) {
+            return NO_ERROR;
+        }
+        if (auto res = this->dispatchRecord(type, message); res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
+        }
+        if (count % batchSize == 0) {
+            this->notifyParsers();
+        }
+    }
+}
+
+void Pipeline::parseRecords(ParserStage& stage)
+{
+    bool produced = false;
+    while (auto raw = stage.queue.front()) {
+        auto res = Record::parse(raw->message(), wantedFields(raw->type));
+        if (res.isError()) {
+            this->parseFailures.fetch_add(1, std::memory_order_relaxed);
+            LOG << std::get<0>(res).message << std::endl;
+        } else if (auto event =
+                       stage.assembler.addRecord(raw->type, std::get<1>(res))) {
+            if (this->shedReads.load(std::memory_order_relaxed) &&
+                event->isReadOnly()) {
+                this->shedEvents.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                event->getTiming().read = raw->readTime;
+                event->getTiming().assembled = EventTiming::Clock::now();
+                this->pushEvent(*event);
+                produced = true;
+            }
+        }
+        stage.queue.pop();
+    }
+    if (produced) {
+        this->eventNotifier->notify();
+    }
+}
+
+void Pipeline::pushEvent(Event& event)
+{
+    while (!this->events.tryPush(event)) {
+        this->eventStalls++;
+        this->eventNotifier->notify();
+        std::this_thread::sleep_for(fullQueueBackoff);
+    }
+}
+
+void Pipeline::writeEvents()
+{
+    Event event;
+    while (this->events.tryPop(event)) {
+        if (auto res = this->handler->processEvent(event); res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
+        }
+        if (this->observer) {
+            event.getTiming().processed = EventTiming::Clock::now();
+            this->observer(event);
+        }
+    }
+}
+
+void Pipeline::setEchoRecords(bool echo)
+{
+    this->echoRecords = echo;
+}
+
+void Pipeline::setShedReads(bool shed)
+{
+    this->shedReads.store(shed, std::memory_order_relaxed);
+}
+
+bool Pipeline::shedsReads() const
+{
+    return this->shedReads.load(std::memory_order_relaxed);
+}
+
+uint64_t Pipeline::shedCount() const
+{
+    return this->shedEvents.load(std::memory_order_relaxed);
+}
+
+std::vector<QueueStats> Pipeline::queueStats() const
+{
+    std::vector<QueueStats> stats;
+    for (size_t i = 0; i < this->parsers.size(); ++i) {
+        const auto& stage = *this->parsers[i];
+        stats.push_back({ "parser" + std::to_string(i),
+                          stage.queue.size(),
+                          stage.queue.capacity(),
+                          stage.stalls.load() });
+    }
+    stats.push_back({ "writer",
+                      this->events.size(),
+                      this->events.capacity(),
+                      this->eventStalls.load() });
+    return stats;
+}
+
+RecordStats Pipeline::recordStats() const
+{
+    RecordStats stats;
+    for (int type = firstRecordType; type <= lastRecordType; ++type) {
+        auto count = this->recordCounts[type - firstRecordType].load(
+            std::memory_order_relaxed);
+        if (count > 0) {
+            stats.received.emplace_back(type, count);
+        }
+    }
+    stats.parseFailures = this->parseFailures.load(std::memory_order_relaxed);
+    return stats;
+}
+
+AssemblerStats Pipeline::assemblerStats() const
+{
+    AssemblerStats total{ 0, 0, 0 };
+    for (const auto& parser : this->parsers) {
+        auto stats = parser->assembler.stats();
+        total.pending += stats.pending;
+        total.timedOut += stats.timedOut;
+        total.evicted += stats.evicted;
+    }
+    return total;
+}
+
+void Pipeline::reportBackpressure()
+{
+    auto assembler = this->assemblerStats();
+    size_t drops = assembler.timedOut + assembler.evicted;
+    if (drops != this->reportedDrops) {
+        this->reportedDrops = drops;
+        LOG << "incomplete events dropped: " << assembler.timedOut
+            << " timed out, " << assembler.evicted << " evicted, "
+            << assembler.pending << " pending" << std::endl;
+    }
+
+    auto stats = this->queueStats();
+    size_t totalStalls = 0;
+    bool backedUp = false;
+    for (const auto& stage : stats) {
+        totalStalls += stage.stalls;
+        backedUp = backedUp || stage.depth * 2 > stage.capacity;
+    }
+    if (!backedUp && totalStalls == this->reportedStalls) {
+        return;
+    }
+    this->reportedStalls = totalStalls;
+
+    auto& log = LOG << "queue depths:";
+    for (const auto& stage : stats) {
+        log << " " << stage.stage << "=" << stage.depth << "/"
+            << stage.capacity << " (" << stage.stalls << " stalls)";
+    }
+    log << std::endl;
+}
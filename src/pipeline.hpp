@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <libaudit.h>
+
+#include <config.hpp>
+#include <event.hpp>
+#include <loop.hpp>
+#include <queue.hpp>
+#include <source.hpp>
+#include <util.hpp>
+
+// Audit message on its way from the reader to a parser thread
+struct RawRecord
+{
+    int type;
+    size_t len;
+    EventTiming::Clock::time_point readTime;
+    char data[MAX_AUDIT_MESSAGE_LENGTH];
+
+    std::string_view message() const
+    {
+        return std::string_view(this->data, this->len);
+    }
+};
+
+struct RecordStats
+{
+    // (record type, number of records received), for types seen so far
+    std::vector<std::pair<int, uint64_t>> received;
+    // records that couldn't be parsed
+    uint64_t parseFailures;
+};
+
+struct QueueStats
+{
+    std::string stage;
+    size_t depth;
+    size_t capacity;
+    // number of times the producer had to wait because the queue was full
+    size_t stalls;
+};
+
+// Moves audit events through three stages:
+//  - the reader (whichever thread calls readRecords) drains the event source
+//    and hands the records to the parser threads, sharded by sequence number
+//    so that all records of an event end up on the same thread,
+//  - parser threads parse the records and assemble them into events,
+//  - a single writer thread processes the finished events, i.e. updates the
+//    watches and writes the log.
+// A slow stage only fills up its input queue, the reader keeps draining the
+// source until the queues are full.
+class Pipeline
+{
+public:
+    // called on the writer thread with every processed event
+    using Observer = std::function<void(const Event&)>;
+
+private:
+    // the range of valid record types
+    static constexpr int firstRecordType = 1000;
+    static constexpr int lastRecordType = 1807;
+
+    struct ParserStage
+    {
+        SpscQueue<RawRecord> queue;
+        std::atomic<size_t> stalls;
+        std::shared_ptr<Notifier> notifier;
+        std::shared_ptr<EventLoop> loop;
+        EventAssembler assembler;
+        std::thread thread;
+
+        ParserStage(const Config& config);
+    };
+
+    std::shared_ptr<EventSource> source;
+    std::shared_ptr<EventHandler> handler;
+    Observer observer;
+    // print every record to stdout
+    bool echoRecords;
+    std::atomic<uint64_t> recordCounts[lastRecordType - firstRecordType + 1];
+    std::atomic<uint64_t> parseFailures;
+    // drop read events instead of passing them to the writer
+    std::atomic<bool> shedReads;
+    std::atomic<uint64_t> shedEvents;
+    std::vector<std::unique_ptr<ParserStage>> parsers;
+    // parsers that got records from the current batch
+    std::vector<bool> parsersToNotify;
+
+    MpscQueue<Event> events;
+    std::atomic<size_t> eventStalls;
+    std::shared_ptr<Notifier> eventNotifier;
+    std::shared_ptr<EventLoop> writerLoop;
+    std::thread writerThread;
+
+    // total stall count at the last backpressure report
+    size_t reportedStalls;
+    // incomplete events dropped at the last report
+    size_t reportedDrops;
+
+    Pipeline(std::shared_ptr<EventSource> source,
+             std::shared_ptr<EventHandler> handler,
+             const Config& config,
+             Observer observer);
+
+    Result<> dispatchRecord(int type, std::string_view message);
+    void notifyParsers();
+
+    void parseRecords(ParserStage& stage);
+    void pushEvent(Event& event);
+    void writeEvents();
+
+public:
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Stops the threads. Whatever is already queued is processed first.
+    ~Pipeline();
+
+    static Result<std::shared_ptr<Pipeline>> create(
+        std::shared_ptr<EventSource> source,
+        std::shared_ptr<EventHandler> handler,
+        const Config& config,
+        Observer observer = nullptr);
+
+    // Reads all records that are available from the source without blocking.
+    // The parser threads are woken up after every batch of records.
+    Result<> readRecords();
+
+    // Records are only printed to stdout, as they are received, if enabled.
+    // Meant for debugging, must be set before reading starts.
+    void setEchoRecords(bool echo);
+
+    // While set, the parser threads drop events that only read, so that the
+    // writer only has the writes, creates, deletes and the rest to keep up
+    // with. Can be changed from any thread.
+    void setShedReads(bool shed);
+    bool shedsReads() const;
+    // read events dropped so far
+    uint64_t shedCount() const;
+
+    std::vector<QueueStats> queueStats() const;
+
+    RecordStats recordStats() const;
+
+    // summed over the parser threads
+    AssemblerStats assemblerStats() const;
+
+    // Logs the queue stats if a queue is more than half full or a producer had
+    // to wait since the last report, and the number of incomplete events
+    // dropped if there were new ones.
+    void reportBackpressure();
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Bounded lock-free queues connecting the threads of the event pipeline.
+// Capacities are rounded up to a power of two.
+
+inline size_t roundUpToPowerOfTwo(size_t n)
+{
+    size_t res = 1;
+    while (res < n) {
+        res <<= 1;
+    }
+    return res;
+}
+
+// Single producer, single consumer ring. Items are written and read in place,
+// so large items don't have to be copied around.
+template<class T>
+class SpscQueue
+{
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head; // next slot to read
+    alignas(64) std::atomic<size_t> tail; // next slot to write
+
+public:
+    explicit SpscQueue(size_t capacity)
+        : slots(roundUpToPowerOfTwo(capacity))
+        , mask(slots.size() - 1)
+        , head(0)
+        , tail(0)
+    {}
+
+    // producer side: returns the slot to fill in or nullptr if the queue is
+    // full; the item becomes visible to the consumer on commit()
+    T* prepare()
+    {
+        size_t t = this->tail.load(std::memory_order_relaxed);
+        if (t - this->head.load(std::memory_order_acquire) ==
+            this->slots.size()) {
+            return nullptr;
+        }
+        return &this->slots[t & this->mask];
+    }
+
+    void commit() { this->tail.fetch_add(1, std::memory_order_release); }
+
+    // consumer side: returns the oldest item or nullptr if the queue is empty;
+    // the slot is released on pop()
+    T* front()
+    {
+        size_t h = this->head.load(std::memory_order_relaxed);
+        if (h == this->tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &this->slots[h & this->mask];
+    }
+
+    void pop() { this->head.fetch_add(1, std::memory_order_release); }
+
+    size_t size() const
+    {
+        return this->tail.load(std::memory_order_relaxed) -
+               this->head.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const { return this->slots.size(); }
+};
+
+// Multiple producer, single consumer ring (bounded MPMC design by Dmitry
+// Vyukov with a single consumer). Items are moved in and out.
+template<class T>
+class MpscQueue
+{
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail; // next slot to write
+    alignas(64) std::atomic<size_t> head; // next slot to read
+
+public:
+    explicit MpscQueue(size_t capacity)
+        : slots(new Slot[roundUpToPowerOfTwo(capacity)])
+        , mask(roundUpToPowerOfTwo(capacity) - 1)
+        , tail(0)
+        , head(0)
+    {
+        for (size_t i = 0; i <= this->mask; ++i) {
+            this->slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // returns false if the queue is full, value is left untouched then
+    bool tryPush(T& value)
+    {
+        size_t pos = this->tail.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = this->slots[pos & this->mask];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = intptr_t(seq) - intptr_t(pos);
+            if (diff == 0) {
+                if (this->tail.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = this->tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // returns false if the queue is empty
+    bool tryPop(T& value)
+    {
+        size_t pos = this->head.load(std::memory_order_relaxed);
+        auto& slot = this->slots[pos & this->mask];
+        size_t seq = slot.sequence.load(std::memory_order_acquire);
+        if (intptr_t(seq) - intptr_t(pos + 1) < 0) {
+            return false;
+        }
+        value = std::move(slot.value);
+        slot.sequence.store(pos + this->mask + 1, std::memory_order_release);
+        this->head.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t t = this->tail.load(std::memory_order_relaxed);
+        size_t h = this->head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+    size_t capacity() const { return this->mask + 1; }
+};
@@ -0,0 +1,497 @@
+#include <rotation.hpp>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(LOG_COMPRESSION_ZSTD)
+#include <zstd.h>
+#elif defined(LOG_COMPRESSION_ZLIB)
+#include <zlib.h>
+#endif
+
+namespace {
+
+// full buffers the background thread may fall behind by before append()
+// has to wait
+constexpr size_t maxPendingBuffers = 8;
+
+// how often waiting for the background thread is logged at most
+constexpr auto stallReportInterval = std::chrono::seconds(10);
+
+// Appends to a file descriptor and keeps track of the file size.
+class PlainSegment : public SegmentFile
+{
+    int fd;
+    size_t bytes;
+
+public:
+    PlainSegment(int fd, size_t bytes)
+        : fd(fd)
+        , bytes(bytes)
+    {}
+
+    ~PlainSegment() { close(this->fd); }
+
+    Result<> write(std::string_view data) override
+    {
+        while (!data.empty()) {
+            auto written = ::write(this->fd, data.data(), data.size());
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ERROR(strerror(errno));
+            }
+            data.remove_prefix(written);
+            this->bytes += written;
+        }
+        return NO_ERROR;
+    }
+
+    Result<> finish() override { return NO_ERROR; }
+
+    Result<> sync() override
+    {
+        RETURN_IF_C_ERROR(fdatasync(this->fd));
+        return NO_ERROR;
+    }
+
+    size_t size() const override { return this->bytes; }
+};
+
+#if defined(LOG_COMPRESSION_ZSTD)
+
+constexpr std::string_view compressedExtension = ".zst";
+
+class CompressedSegment : public PlainSegment
+{
+    ZSTD_CCtx* context;
+    std::vector<char> output;
+
+    // runs the compressor on input until it has consumed all of it and
+    // produced everything for the given directive
+    Result<> compress(std::string_view input, ZSTD_EndDirective directive)
+    {
+        ZSTD_inBuffer in = { input.data(), input.size(), 0 };
+        while (true) {
+            ZSTD_outBuffer out = {
+                this->output.data(), this->output.size(), 0
+            };
+            size_t remaining =
+                ZSTD_compressStream2(this->context, &out, &in, directive);
+            if (ZSTD_isError(remaining)) {
+                return ERROR(ZSTD_getErrorName(remaining));
+            }
+            RETURN_IF_ERROR(PlainSegment::write(
+                std::string_view(this->output.data(), out.pos)));
+            if (remaining == 0 && in.pos == in.size) {
+                return NO_ERROR;
+            }
+        }
+    }
+
+    CompressedSegment(int fd, size_t bytes)
+        : PlainSegment(fd, bytes)
+        , context(ZSTD_createCCtx())
+        , output(ZSTD_CStreamOutSize())
+    {}
+
+public:
+    ~CompressedSegment() { ZSTD_freeCCtx(this->context); }
+
+    // takes ownership of fd, also if it fails
+    static Result<std::unique_ptr<SegmentFile>> create(int fd, size_t bytes)
+    {
+        auto segment = std::unique_ptr<CompressedSegment>(
+            new CompressedSegment(fd, bytes));
+        if (segment->context == nullptr) {
+            return ERROR("can't create zstd context");
+        }
+        return std::unique_ptr<SegmentFile>(std::move(segment));
+    }
+
+    Result<> write(std::string_view data) override
+    {
+        return this->compress(data, ZSTD_e_flush);
+    }
+
+    Result<> finish() override { return this->compress({}, ZSTD_e_end); }
+};
+
+#elif defined(LOG_COMPRESSION_ZLIB)
+
+constexpr std::string_view compressedExtension = ".gz";
+
+class CompressedSegment : public PlainSegment
+{
+    z_stream stream;
+    std::vector<char> output;
+
+    Result<> compress(std::string_view input, int flush)
+    {
+        this->stream.next_in =
+            reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        this->stream.avail_in = input.size();
+        while (true) {
+            this->stream.next_out =
+                reinterpret_cast<Bytef*>(this->output.data());
+            this->stream.avail_out = this->output.size();
+            int res = deflate(&this->stream, flush);
+            if (res == Z_STREAM_ERROR) {
+                return ERROR("deflate failed");
+            }
+            RETURN_IF_ERROR(PlainSegment::write(std::string_view(
+                this->output.data(),
+                this->output.size() - this->stream.avail_out)));
+            if (flush == Z_FINISH ? res == Z_STREAM_END
+                                  : this->stream.avail_out != 0) {
+                return NO_ERROR;
+            }
+        }
+    }
+
+    CompressedSegment(int fd, size_t bytes)
+        : PlainSegment(fd, bytes)
+        , stream{}
+        , output(1 << 16)
+    {}
+
+public:
+    // a no-op on a stream that was never set up
+    ~CompressedSegment() { deflateEnd(&this->stream); }
+
+    // takes ownership of fd, also if it fails
+    static Result<std::unique_ptr<SegmentFile>> create(int fd, size_t bytes)
+    {
+        auto segment = std::unique_ptr<CompressedSegment>(
+            new CompressedSegment(fd, bytes));
+        // gzip format, so the segments can be read with zcat. Higher levels
+        // are several times slower for little gain on log lines.
+        int res = deflateInit2(&segment->stream,
+                               Z_BEST_SPEED,
+                               Z_DEFLATED,
+                               15 + 16,
+                               8,
+                               Z_DEFAULT_STRATEGY);
+        if (res != Z_OK) {
+            return ERROR(std::string("can't set up zlib: ") + zError(res));
+        }
+        return std::unique_ptr<SegmentFile>(std::move(segment));
+    }
+
+    Result<> write(std::string_view data) override
+    {
+        return this->compress(data, Z_SYNC_FLUSH);
+    }
+
+    Result<> finish() override { return this->compress({}, Z_FINISH); }
+};
+
+#else
+
+constexpr std::string_view compressedExtension = "";
+
+#endif
+
+// true if rotate() could have named a segment name: the time in format,
+// optionally followed by "-N"
+bool isSegmentName(const std::string& name, const std::string& format)
+{
+    tm parsed = {};
+    const char* end = strptime(name.c_str(), format.c_str(), &parsed);
+    if (end == nullptr || end == name.c_str()) {
+        return false;
+    }
+    std::string_view rest(end);
+    return rest.empty() ||
+           (rest.size() > 1 && rest[0] == '-' &&
+            rest.find_first_not_of("0123456789", 1) == std::string_view::npos);
+}
+
+}
+
+std::string_view SegmentFile::extension(bool compress)
+{
+    return compress ? compressedExtension : std::string_view();
+}
+
+Result<std::unique_ptr<SegmentFile>> SegmentFile::open(const std::string& path,
+                                                       bool compress)
+{
+    if (compress && compressedExtension.empty()) {
+        return ERROR("dirwatch was built without log compression");
+    }
+    int fd =
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return ERROR("can't open output file " + path + ": " +
+                     strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return ERROR(strerror(errno));
+    }
+#if defined(LOG_COMPRESSION_ZSTD) || defined(LOG_COMPRESSION_ZLIB)
+    if (compress) {
+        return CompressedSegment::create(fd, st.st_size);
+    }
+#endif
+    return std::unique_ptr<SegmentFile>(
+        std::make_unique<PlainSegment>(fd, st.st_size));
+}
+
+RotatingLog::RotatingLog(const Config& config)
+    : path(config.outputPath)
+    , compress(config.compress)
+    , bufferBytes(std::max<size_t>(config.flushBytes, 1))
+    , rotateBytes(config.rotateBytes)
+    , rotateInterval(config.rotateIntervalSec)
+    , rotateName(config.rotateName)
+    , keepSegments(config.keepSegments)
+    , syncRequested(false)
+    , stopping(false)
+{
+    this->path.append(SegmentFile::extension(this->compress));
+    this->buffer.reserve(this->bufferBytes);
+}
+
+RotatingLog::~RotatingLog()
+{
+    if (!this->thread.joinable()) {
+        return;
+    }
+    this->handOver();
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wakeup.notify_one();
+    this->thread.join();
+}
+
+Result<std::unique_ptr<RotatingLog>> RotatingLog::create(const Config& config)
+{
+    auto log = std::unique_ptr<RotatingLog>(new RotatingLog(config));
+    RETURN_OR_SET(log->segment, SegmentFile::open(log->path, log->compress));
+    log->segmentStart = std::chrono::system_clock::now();
+    auto raw = log.get();
+    log->thread = std::thread([raw]() { raw->run(); });
+    return std::move(log);
+}
+
+Result<> RotatingLog::append(const LogEntry& entry)
+{
+    formatLogLine(entry, this->line);
+    this->buffer.append(this->line);
+    if (this->buffer.size() >= this->bufferBytes) {
+        this->handOver();
+    }
+    return NO_ERROR;
+}
+
+Result<> RotatingLog::flush()
+{
+    this->handOver();
+    return NO_ERROR;
+}
+
+Result<> RotatingLog::sync()
+{
+    this->handOver();
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->syncRequested = true;
+    }
+    this->wakeup.notify_one();
+    return NO_ERROR;
+}
+
+void RotatingLog::handOver()
+{
+    if (this->buffer.empty()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->pending.size() >= maxPendingBuffers) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - this->lastStallReport >= stallReportInterval) {
+            LOG << "log writing is falling behind, waiting" << std::endl;
+            this->lastStallReport = now;
+        }
+        this->drained.wait(lock, [this]() {
+            return this->pending.size() < maxPendingBuffers;
+        });
+    }
+    this->pending.push_back(std::move(this->buffer));
+    if (this->spare.empty()) {
+        this->buffer = std::string();
+        this->buffer.reserve(this->bufferBytes);
+    } else {
+        this->buffer = std::move(this->spare.back());
+        this->spare.pop_back();
+    }
+    lock.unlock();
+    this->wakeup.notify_one();
+}
+
+void RotatingLog::run()
+{
+    auto report = [](Result<> res) {
+        if (res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
+        }
+    };
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        auto ready = [this]() {
+            return !this->pending.empty() || this->syncRequested ||
+                   this->stopping;
+        };
+        if (this->rotateInterval.count() > 0) {
+            this->wakeup.wait_until(
+                lock, this->segmentStart + this->rotateInterval, ready);
+        } else {
+            this->wakeup.wait(lock, ready);
+        }
+        std::deque<std::string> chunks;
+        chunks.swap(this->pending);
+        bool sync = this->syncRequested;
+        this->syncRequested = false;
+        bool stop = this->stopping;
+        lock.unlock();
+        this->drained.notify_one();
+
+        if (this->rotateInterval.count() > 0 &&
+            std::chrono::system_clock::now() >=
+                this->segmentStart + this->rotateInterval) {
+            report(this->rotate());
+        }
+        for (const auto& chunk : chunks) {
+            report(this->writeChunk(chunk));
+        }
+        if (sync && this->segment) {
+            report(this->segment->sync());
+        }
+
+        lock.lock();
+        for (auto& chunk : chunks) {
+            chunk.clear();
+            this->spare.push_back(std::move(chunk));
+        }
+        if (stop && this->pending.empty()) {
+            break;
+        }
+    }
+    lock.unlock();
+
+    if (this->segment) {
+        report(this->segment->finish());
+    }
+}
+
+Result<> RotatingLog::writeChunk(std::string_view chunk)
+{
+    if (!this->segment) {
+        // reopening failed at the last rotation
+        RETURN_OR_SET(this->segment,
+                      SegmentFile::open(this->path, this->compress));
+    }
+    RETURN_IF_ERROR(this->segment->write(chunk));
+    if (this->rotateBytes > 0 && this->segment->size() >= this->rotateBytes) {
+        return this->rotate();
+    }
+    return NO_ERROR;
+}
+
+Result<> RotatingLog::rotate()
+{
+    auto now = std::chrono::system_clock::now();
+    if (this->segment && this->segment->size() == 0) {
+        this->segmentStart = now;
+        return NO_ERROR;
+    }
+    if (this->segment) {
+        RETURN_IF_ERROR(this->segment->finish());
+        this->segment.reset();
+    }
+
+    auto base = this->path.substr(
+        0, this->path.size() - SegmentFile::extension(this->compress).size());
+    time_t seconds = std::chrono::system_clock::to_time_t(now);
+    tm local;
+    localtime_r(&seconds, &local);
+    char name[256];
+    size_t length =
+        strftime(name, sizeof(name), this->rotateName.c_str(), &local);
+    auto target = base + "." + std::string(name, length);
+    auto closed = target + std::string(SegmentFile::extension(this->compress));
+    // the name may not change between rotations
+    for (size_t i = 1; std::filesystem::exists(closed); ++i) {
+        closed = target + "-" + std::to_string(i) +
+                 std::string(SegmentFile::extension(this->compress));
+    }
+    if (rename(this->path.c_str(), closed.c_str()) < 0) {
+        return ERROR("can't rename " + this->path + ": " + strerror(errno));
+    }
+
+    this->segmentStart = now;
+    RETURN_OR_SET(this->segment, SegmentFile::open(this->path, this->compress));
+    this->deleteOldSegments();
+    return NO_ERROR;
+}
+
+void RotatingLog::deleteOldSegments()
+{
+    if (this->keepSegments == 0) {
+        return;
+    }
+    std::filesystem::path active(this->path);
+    auto directory = active.has_parent_path() ? active.parent_path()
+                                              : std::filesystem::path(".");
+    auto extension = SegmentFile::extension(this->compress);
+    std::string prefix = active.filename().string();
+    prefix.resize(prefix.size() - extension.size());
+    prefix.append(".");
+
+    std::vector<
+        std::pair<std::filesystem::file_time_type, std::filesystem::path>>
+        closed;
+    std::error_code err;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(directory, err)) {
+        auto name = entry.path().filename().string();
+        if (name == active.filename() ||
+            name.size() < prefix.size() + extension.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(
+                name.size() - extension.size(), extension.size(), extension) !=
+                0) {
+            continue;
+        }
+        // other files next to the log, e.g. copies, are left alone
+        auto stamp = name.substr(
+            prefix.size(), name.size() - prefix.size() - extension.size());
+        if (!isSegmentName(stamp, this->rotateName)) {
+            continue;
+        }
+        closed.emplace_back(entry.last_write_time(err), entry.path());
+    }
+    if (closed.size() <= this->keepSegments) {
+        return;
+    }
+    std::sort(closed.begin(), closed.end());
+    for (size_t i = 0; i < closed.size() - this->keepSegments; ++i) {
+        if (!std::filesystem::remove(closed[i].second, err)) {
+            LOG << "can't delete old log " << closed[i].second << std::endl;
+        }
+    }
+}
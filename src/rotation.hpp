@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <config.hpp>
+#include <eventlog.hpp>
+#include <util.hpp>
+
+// Output file of one log segment, compressed with the codec dirwatch was
+// built with if asked to.
+class SegmentFile
+{
+public:
+    virtual ~SegmentFile() = default;
+
+    // Opens path for appending. A compressed stream appended to an existing
+    // file starts a new frame, which decompresses as if it was one file.
+    static Result<std::unique_ptr<SegmentFile>> open(const std::string& path,
+                                                     bool compress);
+
+    // Extension of segment files, ".zst" or ".gz", empty without
+    // compression.
+    static std::string_view extension(bool compress);
+
+    // Writes data. Compressed data is flushed, so the file can be read up to
+    // this point while it's still being written.
+    virtual Result<> write(std::string_view data) = 0;
+
+    // Ends the compressed stream.
+    virtual Result<> finish() = 0;
+
+    virtual Result<> sync() = 0;
+
+    // bytes in the file
+    virtual size_t size() const = 0;
+};
+
+// The text log, written to segments that are rotated by size and time. Lines
+// are collected in a buffer on the calling thread; full buffers are handed to
+// a background thread that compresses them, writes them out and rotates the
+// segments, so appending never waits for the disk or the compressor unless
+// the background thread is several buffers behind.
+//
+// The active segment is outputPath (plus the compression extension). On
+// rotation it's renamed to outputPath.NAME, where NAME is rotateName
+// formatted with strftime, and the oldest closed segments beyond
+// keepSegments are deleted.
+class RotatingLog : public EventLog
+{
+    std::string path;
+    bool compress;
+    size_t bufferBytes;
+    size_t rotateBytes;
+    std::chrono::seconds rotateInterval;
+    std::string rotateName;
+    size_t keepSegments;
+
+    // buffer being filled by append()
+    std::string buffer;
+    std::string line;
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable drained;
+    // full buffers waiting for the background thread
+    std::deque<std::string> pending;
+    // written buffers, for reuse
+    std::vector<std::string> spare;
+    bool syncRequested;
+    bool stopping;
+    std::thread thread;
+    std::chrono::steady_clock::time_point lastStallReport;
+
+    // owned by the background thread
+    std::unique_ptr<SegmentFile> segment;
+    std::chrono::system_clock::time_point segmentStart;
+
+    RotatingLog(const Config& config);
+
+    void handOver();
+    void run();
+    Result<> writeChunk(std::string_view chunk);
+    Result<> rotate();
+    void deleteOldSegments();
+
+public:
+    RotatingLog(const RotatingLog&) = delete;
+    RotatingLog& operator=(const RotatingLog&) = delete;
+
+    // writes out everything and ends the active segment's stream
+    ~RotatingLog();
+
+    static Result<std::unique_ptr<RotatingLog>> create(const Config& config);
+
+    Result<> append(const LogEntry& entry) override;
+
+    // hands over the buffer, without waiting for it to be written
+    Result<> flush() override;
+
+    // asks the background thread to sync once it has written what's pending
+    Result<> sync() override;
+};
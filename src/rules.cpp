@@ -0,0 +1,205 @@
+#include <rules.hpp>
+
+#include <iostream>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+namespace {
+
+// Requests sent at once. The acknowledgements of a whole batch have to fit
+// in the socket's receive buffer.
+constexpr size_t maxBatchBytes = 64 * 1024;
+constexpr size_t maxBatchRequests = 64;
+
+// how long the kernel may take to acknowledge a batch
+constexpr int ackTimeoutMs = 5000;
+
+bool isStringField(uint32_t field)
+{
+    switch (field) {
+        case AUDIT_WATCH:
+        case AUDIT_DIR:
+        case AUDIT_FILTERKEY:
+        case AUDIT_EXE:
+            return true;
+        default:
+            return field >= AUDIT_SUBJ_USER && field <= AUDIT_OBJ_LEV_HIGH;
+    }
+}
+
+// "path (key ...)", for error messages
+std::string describeRule(const audit_rule_data& rule)
+{
+    std::string path, key;
+    size_t offset = 0;
+    for (uint32_t i = 0; i < rule.field_count && i < AUDIT_MAX_FIELDS; ++i) {
+        if (!isStringField(rule.fields[i])) {
+            continue;
+        }
+        size_t length = rule.values[i];
+        if (offset + length > rule.buflen) {
+            break;
+        }
+        std::string value(rule.buf + offset, length);
+        offset += length;
+        if (rule.fields[i] == AUDIT_WATCH || rule.fields[i] == AUDIT_DIR) {
+            path = std::move(value);
+        } else if (rule.fields[i] == AUDIT_FILTERKEY) {
+            key = std::move(value);
+        }
+    }
+    return path + " (key " + key + ")";
+}
+
+}
+
+AuditRuleSink::AuditRuleSink(int auditFd)
+    : auditFd(auditFd)
+    , nextSequenceNumber(1)
+    , failures(0)
+{
+    // acknowledgements of failed requests don't need to carry the request
+    int on = 1;
+    setsockopt(auditFd, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+}
+
+AuditRuleSink::~AuditRuleSink()
+{
+    if (auto res = this->flush(); res.isError()) {
+        LOG << std::get<0>(res).message << std::endl;
+    }
+}
+
+Result<> AuditRuleSink::queue(int type, const audit_rule_data* rule)
+{
+    size_t size = sizeof(audit_rule_data) + rule->buflen;
+    size_t length = NLMSG_SPACE(size);
+    if (!this->requests.empty() &&
+        (this->batch.size() + length > maxBatchBytes ||
+         this->requests.size() == maxBatchRequests)) {
+        RETURN_IF_ERROR(this->send());
+    }
+
+    size_t offset = this->batch.size();
+    this->batch.resize(offset + length);
+    auto nlh = reinterpret_cast<nlmsghdr*>(this->batch.data() + offset);
+    nlh->nlmsg_len = NLMSG_LENGTH(size);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    nlh->nlmsg_seq = this->nextSequenceNumber++;
+    nlh->nlmsg_pid = 0;
+
+    auto data = reinterpret_cast<audit_rule_data*>(NLMSG_DATA(nlh));
+    memcpy(data, rule, size);
+    data->flags = AUDIT_FILTER_EXIT;
+    data->action = AUDIT_ALWAYS;
+
+    this->requests.push_back({ nlh->nlmsg_seq, offset, false });
+    return NO_ERROR;
+}
+
+Result<> AuditRuleSink::send()
+{
+    if (this->requests.empty()) {
+        return NO_ERROR;
+    }
+    ScopeGuard clearBatch([&]() {
+        this->batch.clear();
+        this->requests.clear();
+    });
+
+    sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    ssize_t sent;
+    do {
+        sent = sendto(this->auditFd,
+                      this->batch.data(),
+                      this->batch.size(),
+                      0,
+                      reinterpret_cast<sockaddr*>(&addr),
+                      sizeof(addr));
+    } while (sent < 0 && errno == EINTR);
+    RETURN_IF_C_ERROR(sent);
+
+    uint32_t first = this->requests.front().sequenceNumber;
+    size_t remaining = this->requests.size();
+    alignas(nlmsghdr) char reply[16 * 1024];
+    while (remaining > 0) {
+        pollfd pfd = { this->auditFd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, ackTimeoutMs);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        RETURN_IF_C_ERROR(ready);
+        if (ready == 0) {
+            this->failures += remaining;
+            return ERROR("no acknowledgement for " + std::to_string(remaining) +
+                         " audit rule request(s)");
+        }
+
+        ssize_t received = recv(this->auditFd, reply, sizeof(reply), 0);
+        if (received < 0 && errno == ENOBUFS) {
+            // the kernel dropped acknowledgements, the rest won't come
+            this->failures += remaining;
+            return ERROR("lost acknowledgements for " +
+                         std::to_string(remaining) + " audit rule request(s)");
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        RETURN_IF_C_ERROR(received);
+
+        int length = received;
+        for (auto nlh = reinterpret_cast<nlmsghdr*>(reply);
+             NLMSG_OK(nlh, length);
+             nlh = NLMSG_NEXT(nlh, length)) {
+            size_t index = nlh->nlmsg_seq - first;
+            if (nlh->nlmsg_type != NLMSG_ERROR ||
+                index >= this->requests.size() ||
+                this->requests[index].acknowledged) {
+                continue;
+            }
+            auto& request = this->requests[index];
+            request.acknowledged = true;
+            remaining--;
+
+            int error = reinterpret_cast<nlmsgerr*>(NLMSG_DATA(nlh))->error;
+            if (error == 0) {
+                continue;
+            }
+            this->failures++;
+            auto sentNlh = reinterpret_cast<const nlmsghdr*>(
+                this->batch.data() + request.offset);
+            LOG << "can't "
+                << (sentNlh->nlmsg_type == AUDIT_ADD_RULE ? "add" : "delete")
+                << " audit rule for "
+                << describeRule(*reinterpret_cast<const audit_rule_data*>(
+                       NLMSG_DATA(sentNlh)))
+                << ": " << strerror(-error) << std::endl;
+        }
+    }
+    return NO_ERROR;
+}
+
+Result<> AuditRuleSink::addRule(audit_rule_data* rule)
+{
+    return this->queue(AUDIT_ADD_RULE, rule);
+}
+
+Result<> AuditRuleSink::deleteRule(audit_rule_data* rule)
+{
+    return this->queue(AUDIT_DEL_RULE, rule);
+}
+
+Result<> AuditRuleSink::flush()
+{
+    RETURN_IF_ERROR(this->send());
+    if (this->failures > 0) {
+        auto count = this->failures;
+        this->failures = 0;
+        return ERROR(std::to_string(count) + " audit rule request(s) failed");
+    }
+    return NO_ERROR;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <libaudit.h>
+
+#include <util.hpp>
+
+// Destination of audit rules: the kernel, or a stand-in in benchmarks.
+// Rules may be applied later, but no later than the next flush().
+class RuleSink
+{
+public:
+    virtual ~RuleSink() = default;
+
+    // The rule is copied if needed, the caller keeps ownership.
+    virtual Result<> addRule(audit_rule_data* rule) = 0;
+    virtual Result<> deleteRule(audit_rule_data* rule) = 0;
+
+    // Applies everything added so far. Fails if any rule failed since the
+    // last flush.
+    virtual Result<> flush() { return NO_ERROR; }
+};
+
+// Adds and deletes exit filter rules through an audit netlink socket.
+//
+// libaudit waits for the kernel's acknowledgement after every message.
+// Instead, this packs up to a datagram's worth of requests into a single
+// send, then reads back the acknowledgements and matches them to the
+// requests by netlink sequence number. Failed rules are logged one by one.
+class AuditRuleSink : public RuleSink
+{
+    struct Request
+    {
+        uint32_t sequenceNumber;
+        // position of the netlink message in batch
+        size_t offset;
+        bool acknowledged;
+    };
+
+    int auditFd;
+    uint32_t nextSequenceNumber;
+    // netlink messages not sent yet
+    std::vector<char> batch;
+    std::vector<Request> requests;
+    // rules that failed since the last flush
+    size_t failures;
+
+    Result<> queue(int type, const audit_rule_data* rule);
+    // Sends the batch and waits for every acknowledgement.
+    Result<> send();
+
+public:
+    AuditRuleSink(int auditFd);
+
+    AuditRuleSink(const AuditRuleSink&) = delete;
+    AuditRuleSink& operator=(const AuditRuleSink&) = delete;
+
+    ~AuditRuleSink();
+
+    Result<> addRule(audit_rule_data* rule) override;
+    Result<> deleteRule(audit_rule_data* rule) override;
+    Result<> flush() override;
+};
@@ -0,0 +1,169 @@
+#include <scan.hpp>
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DIRWATCH_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr size_t blockSize = 64;
+constexpr size_t delimiterCount = sizeof(DelimiterScanner::delimiters);
+
+using ClassifyFn = void (*)(const char* block, uint64_t* masks);
+
+void classifyScalar(const char* block, uint64_t* masks)
+{
+    for (size_t d = 0; d < delimiterCount; ++d) {
+        masks[d] = 0;
+    }
+    for (size_t i = 0; i < blockSize; ++i) {
+        for (size_t d = 0; d < delimiterCount; ++d) {
+            if (block[i] == DelimiterScanner::delimiters[d]) {
+                masks[d] |= uint64_t(1) << i;
+            }
+        }
+    }
+}
+
+#ifdef DIRWATCH_X86
+
+__attribute__((target("sse2"))) void classifySse2(const char* block,
+                                                  uint64_t* masks)
+{
+    __m128i chunks[4];
+    for (size_t c = 0; c < 4; ++c) {
+        chunks[c] =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + c * 16));
+    }
+    for (size_t d = 0; d < delimiterCount; ++d) {
+        auto delim = _mm_set1_epi8(DelimiterScanner::delimiters[d]);
+        uint64_t mask = 0;
+        for (size_t c = 0; c < 4; ++c) {
+            uint64_t bits = uint16_t(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(chunks[c], delim)));
+            mask |= bits << (c * 16);
+        }
+        masks[d] = mask;
+    }
+}
+
+__attribute__((target("avx2"))) void classifyAvx2(const char* block,
+                                                  uint64_t* masks)
+{
+    auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    auto hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    for (size_t d = 0; d < delimiterCount; ++d) {
+        auto delim = _mm256_set1_epi8(DelimiterScanner::delimiters[d]);
+        uint64_t loBits =
+            uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, delim)));
+        uint64_t hiBits =
+            uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, delim)));
+        masks[d] = loBits | (hiBits << 32);
+    }
+}
+
+#endif
+
+ClassifyFn implFunction(ScanImpl impl)
+{
+    switch (impl) {
+#ifdef DIRWATCH_X86
+        case ScanImpl::Sse2:
+            return &classifySse2;
+        case ScanImpl::Avx2:
+            return &classifyAvx2;
+#endif
+        default:
+            return &classifyScalar;
+    }
+}
+
+ClassifyFn classify = implFunction(bestScanImpl());
+
+constexpr size_t delimiterIndex(char c)
+{
+    for (size_t d = 0; d < delimiterCount; ++d) {
+        if (DelimiterScanner::delimiters[d] == c) {
+            return d;
+        }
+    }
+    return delimiterCount;
+}
+
+}
+
+bool isScanImplSupported(ScanImpl impl)
+{
+#ifdef DIRWATCH_X86
+    // may run from a static initializer, before the cpu model is set up
+    __builtin_cpu_init();
+#endif
+    switch (impl) {
+        case ScanImpl::Scalar:
+            return true;
+#ifdef DIRWATCH_X86
+        case ScanImpl::Sse2:
+            return __builtin_cpu_supports("sse2");
+        case ScanImpl::Avx2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+ScanImpl bestScanImpl()
+{
+    if (isScanImplSupported(ScanImpl::Avx2)) {
+        return ScanImpl::Avx2;
+    }
+    if (isScanImplSupported(ScanImpl::Sse2)) {
+        return ScanImpl::Sse2;
+    }
+    return ScanImpl::Scalar;
+}
+
+void setScanImpl(ScanImpl impl)
+{
+    classify = implFunction(impl);
+}
+
+DelimiterScanner::DelimiterScanner(std::string_view data)
+    : data(data)
+    , blockStart(data.size())
+{}
+
+void DelimiterScanner::loadBlock(size_t start)
+{
+    this->blockStart = start;
+    if (start + blockSize <= this->data.size()) {
+        classify(this->data.data() + start, this->masks);
+        return;
+    }
+    // pad the last partial block with zeroes, which never match
+    char tail[blockSize] = {};
+    memcpy(tail, this->data.data() + start, this->data.size() - start);
+    classify(tail, this->masks);
+}
+
+size_t DelimiterScanner::find(size_t pos, char a, char b)
+{
+    size_t da = delimiterIndex(a);
+    size_t db = delimiterIndex(b);
+    while (pos < this->data.size()) {
+        size_t start = pos - pos % blockSize;
+        if (start != this->blockStart) {
+            this->loadBlock(start);
+        }
+        uint64_t mask =
+            (this->masks[da] | this->masks[db]) >> (pos - start);
+        if (mask != 0) {
+            return pos + __builtin_ctzll(mask);
+        }
+        pos = start + blockSize;
+    }
+    return this->data.size();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+// Vectorized delimiter search used by the record parser. The implementation
+// is picked once at startup based on what the CPU supports.
+
+enum class ScanImpl
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+ScanImpl bestScanImpl();
+bool isScanImplSupported(ScanImpl impl);
+
+// Overrides the implementation used by DelimiterScanner. Meant for benchmarks
+// and comparisons; impl must be supported.
+void setScanImpl(ScanImpl impl);
+
+// Finds delimiter characters in a buffer. The buffer is classified one 64 byte
+// block at a time and the result is kept, so consecutive searches within a
+// block don't look at the data again.
+class DelimiterScanner
+{
+    std::string_view data;
+    size_t blockStart;
+    // one bit per byte of the current block, for each delimiter
+    uint64_t masks[5];
+
+    void loadBlock(size_t start);
+
+public:
+    // the characters find() can look for
+    static constexpr char delimiters[] = { '=', ' ', '"', '\'', '\\' };
+
+    DelimiterScanner(std::string_view data);
+
+    // Returns the index of the first byte at or after pos that is equal to a
+    // or b, or the size of the data if there's no such byte.
+    size_t find(size_t pos, char a, char b);
+};
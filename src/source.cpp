@@ -0,0 +1,266 @@
+#include <source.hpp>
+
+#include <charconv>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+// number of audit messages received at once
+constexpr size_t netlinkBatchSize = 64;
+
+// buffer of the recording, flushed when full and when dirwatch stops
+constexpr size_t recordingBufferSize = 1 << 20;
+
+// requested size of the pipe from auditd, so it can absorb bursts while the
+// parsers are busy
+constexpr int streamPipeSize = 1 << 20;
+
+}
+
+bool parseRecordLine(std::string_view line,
+                     int& type,
+                     std::string_view& message)
+{
+    constexpr std::string_view nodePrefix = "node=";
+    constexpr std::string_view typePrefix = "type=";
+    constexpr std::string_view msgPrefix = " msg=";
+    // auditd prepends the host name if name_format is set
+    if (line.substr(0, nodePrefix.size()) == nodePrefix) {
+        auto space = line.find(' ');
+        if (space == std::string_view::npos) {
+            return false;
+        }
+        line.remove_prefix(space + 1);
+    }
+    if (line.substr(0, typePrefix.size()) != typePrefix) {
+        return false;
+    }
+    auto sep = line.find(msgPrefix);
+    if (sep == std::string_view::npos) {
+        return false;
+    }
+    auto name = line.substr(typePrefix.size(), sep - typePrefix.size());
+    message = line.substr(sep + msgPrefix.size());
+    // with log_format = ENRICHED, resolved fields follow a group separator
+    message = message.substr(0, message.find('\x1d'));
+
+    // auditd writes types it has no name for as UNKNOWN[number]
+    constexpr std::string_view unknownPrefix = "UNKNOWN[";
+    if (name.substr(0, unknownPrefix.size()) == unknownPrefix) {
+        auto end = name.data() + name.size() - 1;
+        auto res =
+            std::from_chars(name.data() + unknownPrefix.size(), end, type);
+        return res.ec == std::errc() && res.ptr == end && *end == ']';
+    }
+    char nameBuf[64];
+    if (name.size() >= sizeof(nameBuf)) {
+        return false;
+    }
+    memcpy(nameBuf, name.data(), name.size());
+    nameBuf[name.size()] = '\0';
+    type = audit_name_to_msg_type(nameBuf);
+    return type >= 0;
+}
+
+NetlinkSource::NetlinkSource(int auditFd)
+    : auditFd(auditFd)
+    , batch(netlinkBatchSize)
+    , received(0)
+    , next(0)
+{}
+
+int NetlinkSource::getFd() const
+{
+    return this->auditFd;
+}
+
+Result<bool> NetlinkSource::nextRecord(int& type, std::string_view& message)
+{
+    if (this->next == this->received) {
+        this->received = 0;
+        this->next = 0;
+        int res = 0;
+        while (this->received < this->batch.size()) {
+            res = audit_get_reply(this->auditFd,
+                                  &this->batch[this->received],
+                                  GET_REPLY_NONBLOCKING,
+                                  0);
+            if (res <= 0) {
+                break;
+            }
+            this->received++;
+        }
+        if (this->received == 0) {
+            if (res == -EAGAIN || res == 0) {
+                return false;
+            }
+            return ERROR(strerror(-res));
+        }
+    }
+    const auto& reply = this->batch[this->next++];
+    type = reply.type;
+    message = std::string_view(reply.message, reply.len);
+    return true;
+}
+
+StreamSource::StreamSource(int fd, size_t bufferSize)
+    : fd(fd)
+    , buffer(bufferSize)
+    , start(0)
+    , end(0)
+    , closed(false)
+{}
+
+Result<std::unique_ptr<StreamSource>> StreamSource::create(int fd,
+                                                           size_t bufferSize)
+{
+    int flags = fcntl(fd, F_GETFL);
+    RETURN_IF_C_ERROR(flags);
+    RETURN_IF_C_ERROR(fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+    // fails if fd isn't a pipe, which is fine
+    fcntl(fd, F_SETPIPE_SZ, streamPipeSize);
+    return std::unique_ptr<StreamSource>(new StreamSource(fd, bufferSize));
+}
+
+int StreamSource::getFd() const
+{
+    return this->fd;
+}
+
+Result<bool> StreamSource::nextRecord(int& type, std::string_view& message)
+{
+    while (true) {
+        auto data = this->buffer.data();
+        auto newline = static_cast<char*>(
+            memchr(data + this->start, '\n', this->end - this->start));
+        if (newline != nullptr) {
+            std::string_view line(data + this->start,
+                                  newline - data - this->start);
+            this->start = newline - data + 1;
+            if (parseRecordLine(line, type, message)) {
+                return true;
+            }
+            continue;
+        }
+        if (this->closed) {
+            return false;
+        }
+
+        // keep the partial line at the end and fill up the rest
+        memmove(data, data + this->start, this->end - this->start);
+        this->end -= this->start;
+        this->start = 0;
+        if (this->end == this->buffer.size()) {
+            // the rest of the line is skipped as malformed
+            this->end = 0;
+            return ERROR("record longer than the read buffer, dropped");
+        }
+
+        auto count =
+            read(this->fd, data + this->end, this->buffer.size() - this->end);
+        if (count > 0) {
+            this->end += count;
+        } else if (count == 0) {
+            // the last line may lack its newline
+            if (this->end > 0) {
+                data[this->end++] = '\n';
+            }
+            this->closed = true;
+        } else if (errno == EAGAIN) {
+            return false;
+        } else if (errno != EINTR) {
+            return ERROR(strerror(errno));
+        }
+    }
+}
+
+RecordingSource::RecordingSource(std::unique_ptr<EventSource> inner)
+    : inner(std::move(inner))
+{}
+
+Result<std::unique_ptr<RecordingSource>> RecordingSource::create(
+    std::unique_ptr<EventSource> inner,
+    const std::string& path)
+{
+    auto source = std::unique_ptr<RecordingSource>(
+        new RecordingSource(std::move(inner)));
+    RETURN_OR_SET(source->output,
+                  LogWriter::create(path, recordingBufferSize));
+    return std::move(source);
+}
+
+int RecordingSource::getFd() const
+{
+    return this->inner->getFd();
+}
+
+Result<bool> RecordingSource::nextRecord(int& type, std::string_view& message)
+{
+    RETURN_OR_SET(bool found, this->inner->nextRecord(type, message));
+    if (!found) {
+        return false;
+    }
+
+    this->line.assign("type=");
+    if (auto name = audit_msg_type_to_name(type)) {
+        this->line.append(name);
+    } else {
+        this->line.append("UNKNOWN[").append(std::to_string(type)).append("]");
+    }
+    this->line.append(" msg=").append(message).append("\n");
+    RETURN_IF_ERROR(this->output->append(this->line));
+    return true;
+}
+
+Result<> RecordingSource::flush()
+{
+    return this->output->flush();
+}
+
+ReplaySource::ReplaySource(std::string data, size_t rounds)
+    : data(std::move(data))
+    , pos(0)
+    , roundsLeft(rounds)
+{}
+
+Result<std::unique_ptr<ReplaySource>> ReplaySource::load(
+    const std::string& path,
+    size_t rounds)
+{
+    std::ifstream input(path);
+    if (!input.is_open()) {
+        return ERROR("can't open " + path);
+    }
+    std::stringstream data;
+    data << input.rdbuf();
+    return std::make_unique<ReplaySource>(data.str(), rounds);
+}
+
+int ReplaySource::getFd() const
+{
+    return -1;
+}
+
+Result<bool> ReplaySource::nextRecord(int& type, std::string_view& message)
+{
+    std::string_view data(this->data);
+    while (this->roundsLeft > 0) {
+        if (this->pos >= data.size()) {
+            this->pos = 0;
+            this->roundsLeft--;
+            continue;
+        }
+        auto end = std::min(data.find('\n', this->pos), data.size());
+        auto line = data.substr(this->pos, end - this->pos);
+        this->pos = end + 1;
+        if (parseRecordLine(line, type, message)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libaudit.h>
+
+#include <logwriter.hpp>
+#include <util.hpp>
+
+// Where the pipeline gets audit records from.
+class EventSource
+{
+public:
+    virtual ~EventSource() = default;
+
+    // Becomes readable when records may be available, for the event loop.
+    // -1 if the source can't be polled.
+    virtual int getFd() const = 0;
+
+    // Gets the next record without blocking. Returns false if there is none
+    // right now. message points into the source's buffers and is valid until
+    // the next call.
+    virtual Result<bool> nextRecord(int& type, std::string_view& message) = 0;
+};
+
+// Splits a line in the auditd log format, "type=NAME msg=MESSAGE", which is
+// also what auditd sends to plugins. A node= prefix and enriched fields are
+// dropped. Returns false if the line is malformed or the type unknown.
+bool parseRecordLine(std::string_view line,
+                     int& type,
+                     std::string_view& message);
+
+// Records sent by the kernel to an audit netlink socket. The socket has to be
+// registered with audit_set_pid.
+class NetlinkSource : public EventSource
+{
+    int auditFd;
+    // receive buffers for one batch of audit messages
+    std::vector<audit_reply> batch;
+    size_t received;
+    size_t next;
+
+public:
+    NetlinkSource(int auditFd);
+
+    int getFd() const override;
+    Result<bool> nextRecord(int& type, std::string_view& message) override;
+};
+
+// Records in the auditd log format read from a stream, e.g. the stdin of an
+// auditd plugin. Lines are split in place in a single large buffer.
+class StreamSource : public EventSource
+{
+    int fd;
+    std::vector<char> buffer;
+    // unread data in buffer
+    size_t start;
+    size_t end;
+    bool closed;
+
+    StreamSource(int fd, size_t bufferSize);
+
+public:
+    // Makes fd non-blocking.
+    static Result<std::unique_ptr<StreamSource>> create(
+        int fd,
+        size_t bufferSize = 1 << 20);
+
+    int getFd() const override;
+    Result<bool> nextRecord(int& type, std::string_view& message) override;
+
+    // true once the writer has closed the stream. The records read before
+    // are still returned by nextRecord.
+    bool isClosed() const { return this->closed; }
+};
+
+// Passes on the records of another source, and appends each of them to a
+// file in the auditd log format, so they can be replayed later.
+class RecordingSource : public EventSource
+{
+    std::unique_ptr<EventSource> inner;
+    std::shared_ptr<LogWriter> output;
+    std::string line;
+
+    RecordingSource(std::unique_ptr<EventSource> inner);
+
+public:
+    static Result<std::unique_ptr<RecordingSource>> create(
+        std::unique_ptr<EventSource> inner,
+        const std::string& path);
+
+    int getFd() const override;
+    Result<bool> nextRecord(int& type, std::string_view& message) override;
+
+    Result<> flush();
+};
+
+// Plays back records in the auditd log format from memory, as fast as they
+// are asked for, optionally several times over. Lines that aren't records
+// are skipped.
+class ReplaySource : public EventSource
+{
+    std::string data;
+    size_t pos;
+    size_t roundsLeft;
+
+public:
+    ReplaySource(std::string data, size_t rounds);
+
+    static Result<std::unique_ptr<ReplaySource>> load(const std::string& path,
+                                                      size_t rounds);
+
+    int getFd() const override;
+    Result<bool> nextRecord(int& type, std::string_view& message) override;
+
+    // true once every round has been played
+    bool finished() const { return this->roundsLeft == 0; }
+};
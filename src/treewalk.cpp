@@ -0,0 +1,284 @@
+#include <treewalk.hpp>
+
+#include <queue.hpp>
+
+#include <atomic>
+#include <deque>
+#include <dirent.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+struct DirectoryId
+{
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const DirectoryId& other) const
+    {
+        return this->dev == other.dev && this->ino == other.ino;
+    }
+};
+
+struct DirectoryIdHash
+{
+    size_t operator()(const DirectoryId& id) const
+    {
+        return std::hash<ino_t>()(id.ino) * 31 + std::hash<dev_t>()(id.dev);
+    }
+};
+
+// Directories seen so far, split into shards so that the walking threads
+// rarely wait for each other.
+class VisitedSet
+{
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_set<DirectoryId, DirectoryIdHash> ids;
+    };
+
+    Shard shards[16];
+
+public:
+    // returns false if the directory was seen before
+    bool insert(const struct stat& st)
+    {
+        DirectoryId id{ st.st_dev, st.st_ino };
+        auto& shard = this->shards[DirectoryIdHash()(id) % 16];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.ids.insert(id).second;
+    }
+};
+
+struct Directory
+{
+    std::string path;
+    size_t index;
+};
+
+// Reads a single directory and passes each entry worth reporting to found.
+template<class F>
+void readDirectory(const Directory& dir,
+                   VisitedSet& visited,
+                   std::atomic<size_t>& nextIndex,
+                   F&& found)
+{
+    auto handle = opendir(dir.path.c_str());
+    if (handle == nullptr) {
+        LOG << "can't read " << dir.path << ": " << strerror(errno)
+            << std::endl;
+        return;
+    }
+    ScopeGuard closeHandle([&]() { closedir(handle); });
+    size_t prefixLength = dir.path == "/" ? 0 : dir.path.size();
+
+    while (auto ent = readdir(handle)) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        bool isDirectory = false;
+        struct stat st;
+        if (ent->d_type != DT_REG) {
+            // directories need the device too, links and unknown types need
+            // to be resolved
+            if (fstatat(dirfd(handle), ent->d_name, &st, 0) != 0) {
+                // dangling link, or deleted since
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                isDirectory = true;
+            } else if (!S_ISREG(st.st_mode)) {
+                continue;
+            }
+        }
+        if (isDirectory && !visited.insert(st)) {
+            continue;
+        }
+
+        TreeEntry entry;
+        entry.path.reserve(prefixLength + 1 + strlen(ent->d_name));
+        entry.path.assign(dir.path, 0, prefixLength);
+        entry.path.append("/").append(ent->d_name);
+        entry.nameStart = prefixLength + 1;
+        entry.parent = dir.index;
+        entry.index = isDirectory ? nextIndex++ : 0;
+        entry.isDirectory = isDirectory;
+        found(std::move(entry));
+    }
+}
+
+Result<> walkSerial(const std::string& root,
+                    VisitedSet& visited,
+                    const std::function<Result<>(const TreeEntry&)>& onEntry)
+{
+    std::atomic<size_t> nextIndex(1);
+    std::vector<Directory> pending = { { root, 0 } };
+    Result<> res = NO_ERROR;
+    while (!pending.empty() && !res.isError()) {
+        auto dir = std::move(pending.back());
+        pending.pop_back();
+        readDirectory(dir, visited, nextIndex, [&](TreeEntry&& entry) {
+            if (res.isError()) {
+                return;
+            }
+            res = onEntry(entry);
+            if (entry.isDirectory) {
+                pending.push_back({ std::move(entry.path), entry.index });
+            }
+        });
+    }
+    return res;
+}
+
+// Each thread works on its own list of directories, newest first, and steals
+// the oldest ones from the others when it runs out.
+class ParallelWalk
+{
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Directory> dirs;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    VisitedSet& visited;
+    std::atomic<size_t> nextIndex;
+    // directories listed or being read
+    std::atomic<size_t> pending;
+    std::atomic<bool> stopped;
+    MpscQueue<TreeEntry> entries;
+
+    bool take(size_t self, Directory& dir)
+    {
+        {
+            auto& own = *this->workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.dirs.empty()) {
+                dir = std::move(own.dirs.back());
+                own.dirs.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < this->workers.size(); ++i) {
+            auto& other = *this->workers[(self + i) % this->workers.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.dirs.empty()) {
+                dir = std::move(other.dirs.front());
+                other.dirs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t self)
+    {
+        Directory dir;
+        while (!this->stopped) {
+            if (!this->take(self, dir)) {
+                if (this->pending == 0) {
+                    return;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            readDirectory(
+                dir, this->visited, this->nextIndex, [&](TreeEntry&& entry) {
+                    Directory subdir;
+                    if (entry.isDirectory) {
+                        subdir = { entry.path, entry.index };
+                    }
+                    // the entry goes out before its own entries can be found
+                    while (!this->entries.tryPush(entry)) {
+                        if (this->stopped) {
+                            return;
+                        }
+                        std::this_thread::yield();
+                    }
+                    if (entry.isDirectory) {
+                        this->pending++;
+                        auto& own = *this->workers[self];
+                        std::lock_guard<std::mutex> lock(own.mutex);
+                        own.dirs.push_back(std::move(subdir));
+                    }
+                });
+            this->pending--;
+        }
+    }
+
+public:
+    ParallelWalk(VisitedSet& visited, size_t threads)
+        : visited(visited)
+        , nextIndex(1)
+        , pending(0)
+        , stopped(false)
+        , entries(4096)
+    {
+        for (size_t i = 0; i < threads; ++i) {
+            this->workers.push_back(std::make_unique<Worker>());
+        }
+    }
+
+    Result<> run(const std::string& root,
+                 const std::function<Result<>(const TreeEntry&)>& onEntry)
+    {
+        this->workers[0]->dirs.push_back({ root, 0 });
+        this->pending = 1;
+
+        std::vector<std::thread> threads;
+        ScopeGuard joinThreads([&]() {
+            this->stopped = true;
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        });
+        for (size_t i = 0; i < this->workers.size(); ++i) {
+            threads.emplace_back([this, i]() { this->work(i); });
+        }
+
+        TreeEntry entry;
+        while (true) {
+            if (this->entries.tryPop(entry)) {
+                RETURN_IF_ERROR(onEntry(entry));
+                continue;
+            }
+            if (this->pending == 0) {
+                // every entry has been pushed by now
+                while (this->entries.tryPop(entry)) {
+                    RETURN_IF_ERROR(onEntry(entry));
+                }
+                return NO_ERROR;
+            }
+            std::this_thread::yield();
+        }
+    }
+};
+
+}
+
+Result<> walkTree(const std::string& root,
+                  size_t threads,
+                  const std::function<Result<>(const TreeEntry&)>& onEntry)
+{
+    struct stat st;
+    RETURN_IF_C_ERROR(stat(root.c_str(), &st));
+    if (!S_ISDIR(st.st_mode)) {
+        return ERROR("not a directory: " + root);
+    }
+    VisitedSet visited;
+    visited.insert(st);
+
+    if (threads <= 1) {
+        return walkSerial(root, visited, onEntry);
+    }
+    ParallelWalk walk(visited, threads);
+    return walk.run(root, onEntry);
+}
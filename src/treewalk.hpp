@@ -0,0 +1,40 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include <util.hpp>
+
+// An entry found by walkTree
+struct TreeEntry
+{
+    std::string path;
+    // position of the file name in path
+    size_t nameStart;
+    // number of the directory containing the entry, the root is 0
+    size_t parent;
+    // number of this entry if it is a directory, entries under it refer to
+    // it as their parent
+    size_t index;
+    bool isDirectory;
+
+    std::string_view name() const
+    {
+        return std::string_view(this->path).substr(this->nameStart);
+    }
+};
+
+// Finds every regular file and directory under root, following symbolic
+// links. Each directory is visited once, identified by device and inode, so
+// bind mounts and symlink loops don't make the walk endless. The traversal
+// uses explicit work lists instead of recursion.
+//
+// With more than one thread, directories are read by a work-stealing pool
+// and the entries are handed over through a queue. onEntry is always called
+// on the calling thread, and a directory is always reported before the
+// entries under it. If onEntry fails, the walk stops with its error.
+// Directories that can't be read are logged and skipped.
+Result<> walkTree(const std::string& root,
+                  size_t threads,
+                  const std::function<Result<>(const TreeEntry&)>& onEntry);
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <functional>
+#include <iterator>
 #include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 // Macro-helper macros
 #define TOSTRING(x) TOSTRING2(x)
@@ -85,18 +88,77 @@ struct ScopeGuard
     ~ScopeGuard();
 };
 
-// PathParts
-class PathParts
+// SmallVector: keeps the first N items inline, spills to the heap after that
+template<class T, size_t N>
+class SmallVector
 {
-    std::vector<std::string> parts;
+    T inlineItems[N];
+    std::vector<T> heapItems;
+    size_t count = 0;
 
 public:
-    PathParts(const std::string& path);
-    PathParts(std::vector<std::string> parts);
+    void push_back(T item)
+    {
+        if (this->count < N && this->heapItems.empty()) {
+            this->inlineItems[this->count++] = std::move(item);
+            return;
+        }
+        if (this->heapItems.empty()) {
+            this->heapItems.assign(std::make_move_iterator(this->inlineItems),
+                                   std::make_move_iterator(this->inlineItems +
+                                                           this->count));
+        }
+        this->heapItems.push_back(std::move(item));
+        this->count++;
+    }
+
+    void clear()
+    {
+        this->heapItems.clear();
+        this->count = 0;
+    }
+
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+
+    T* begin()
+    {
+        return this->heapItems.empty() ? this->inlineItems
+                                       : this->heapItems.data();
+    }
+    T* end() { return this->begin() + this->count; }
+    const T* begin() const
+    {
+        return this->heapItems.empty() ? this->inlineItems
+                                       : this->heapItems.data();
+    }
+    const T* end() const { return this->begin() + this->count; }
+
+    T& operator[](size_t i) { return this->begin()[i]; }
+    const T& operator[](size_t i) const { return this->begin()[i]; }
+};
+
+// Paths
 
-    Result<PathParts> tryRemoveRoot(const PathParts& root) const;
-    PathParts childPath() const;
+// Writes the normalized form of an absolute path to out: empty and "."
+// components are dropped and ".." removes the previous component. The result
+// starts with '/' and has no trailing '/'. out is reused, so normalizing into
+// the same string doesn't allocate once it's large enough.
+void normalizePath(std::string_view path, std::string& out);
 
-    const std::vector<std::string>& getParts() const;
-    std::string toString(bool absolute) const;
-};
\ No newline at end of file
+// Calls func with each non-empty component of a path.
+template<class F>
+void forEachComponent(std::string_view path, F&& func)
+{
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t end = path.find('/', pos);
+        if (end == std::string_view::npos) {
+            end = path.size();
+        }
+        if (end > pos) {
+            func(path.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+}
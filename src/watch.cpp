@@ -1,9 +1,12 @@
 #include <watch.hpp>
 
+#include <atomic>
+#include <charconv>
 #include <filesystem>
 #include <iostream>
 #include <libaudit.h>
 #include <string.h>
+#include <treewalk.hpp>
 
 namespace {
 
@@ -15,166 +18,601 @@ audit_rule_data* newAuditRuleData()
     return rule;
 }
 
+struct RuleSpec
+{
+    // first letter of the key
+    char access;
+    int permissions;
+};
+
+constexpr RuleSpec allAccessTypes[] = {
+    { 'w', AUDIT_PERM_WRITE },
+    { 'r', AUDIT_PERM_READ },
+    { 'x', AUDIT_PERM_EXEC },
+    { 'a', AUDIT_PERM_ATTR },
+};
+
+// Syscalls that can match each permission: those in the kernel's read, write
+// and attribute change classes, and those it checks by their arguments
+// (open*) or that always mean execution (exec*). Some names only exist on
+// some ABIs. Listing a few too many only costs a bit in the mask, the kernel
+// still checks the permission itself.
+const char* const readSyscalls[] = {
+    "open",        "openat",      "openat2",     "readlink",    "readlinkat",
+    "getxattr",    "lgetxattr",   "fgetxattr",   "listxattr",   "llistxattr",
+    "flistxattr",  "getxattrat",  "listxattrat", "quotactl",
+};
+
+const char* const writeSyscalls[] = {
+    "open",          "openat",        "openat2",       "creat",
+    "rename",        "renameat",      "renameat2",     "mkdir",
+    "mkdirat",       "rmdir",         "link",          "linkat",
+    "unlink",        "unlinkat",      "symlink",       "symlinkat",
+    "mknod",         "mknodat",       "truncate",      "truncate64",
+    "ftruncate",     "ftruncate64",   "fallocate",     "setxattr",
+    "lsetxattr",     "fsetxattr",     "removexattr",   "lremovexattr",
+    "fremovexattr",  "setxattrat",    "removexattrat", "acct",
+    "swapon",        "quotactl",      "bind",          "socketcall",
+};
+
+const char* const execSyscalls[] = { "execve", "execveat" };
+
+const char* const attrSyscalls[] = {
+    "chmod",            "fchmod",           "fchmodat",
+    "fchmodat2",        "chown",            "fchown",
+    "lchown",           "fchownat",         "chown32",
+    "fchown32",         "lchown32",         "setxattr",
+    "lsetxattr",        "fsetxattr",        "removexattr",
+    "lremovexattr",     "fremovexattr",     "setxattrat",
+    "removexattrat",    "link",             "linkat",
+    "unlink",           "unlinkat",         "rename",
+    "renameat",         "renameat2",        "utime",
+    "utimes",           "futimesat",        "utimensat",
+    "utimensat_time64",
+};
+
+struct SyscallMask
+{
+    uint32_t bits[AUDIT_BITMASK_SIZE];
+};
+
+// The 32 bit ABI that can run on machine, or -1
+int compatMachine(int machine)
+{
+    switch (machine) {
+        case MACH_86_64:
+            return MACH_X86;
+        case MACH_PPC64:
+            return MACH_PPC;
+        case MACH_S390X:
+            return MACH_S390;
+        case MACH_AARCH64:
+            return MACH_ARM;
+        default:
+            return -1;
+    }
+}
+
+// Syscall numbers are per ABI, and rules without an arch field match them
+// whatever the ABI of the caller. The mask is the union of both ABIs' numbers;
+// a syscall of one ABI that has the number of a listed one of the other still
+// fails the permission check.
+template<size_t N>
+SyscallMask buildMask(const char* const (&names)[N])
+{
+    SyscallMask mask;
+    memset(&mask, 0, sizeof(mask));
+    int machine = audit_detect_machine();
+    for (int abi : { machine, compatMachine(machine) }) {
+        if (abi < 0) {
+            continue;
+        }
+        for (auto name : names) {
+            int nr = audit_name_to_syscall(name, abi);
+            if (nr >= 0 && size_t(nr) < AUDIT_BITMASK_SIZE * 32) {
+                mask.bits[AUDIT_WORD(nr)] |= AUDIT_BIT(nr);
+            }
+        }
+    }
+    return mask;
 }
 
-Watch::Watch(int fd, bool isDir)
-    : isDir(isDir)
-    , auditFd(fd)
-{}
+std::atomic<RuleSyscalls> ruleSyscalls{ RuleSyscalls::Scoped };
+
+// the syscalls of rules with the given permission, nullptr for all of them
+const SyscallMask* scopedSyscalls(int permissions)
+{
+    if (ruleSyscalls.load(std::memory_order_relaxed) != RuleSyscalls::Scoped) {
+        return nullptr;
+    }
+    static const bool known = audit_detect_machine() >= 0;
+    static const SyscallMask masks[] = {
+        buildMask(readSyscalls),
+        buildMask(writeSyscalls),
+        buildMask(execSyscalls),
+        buildMask(attrSyscalls),
+    };
+    if (!known) {
+        return nullptr;
+    }
+    switch (permissions) {
+        case AUDIT_PERM_READ:
+            return &masks[0];
+        case AUDIT_PERM_WRITE:
+            return &masks[1];
+        case AUDIT_PERM_EXEC:
+            return &masks[2];
+        case AUDIT_PERM_ATTR:
+            return &masks[3];
+        default:
+            return nullptr;
+    }
+}
 
-Result<> Watch::addRule(const std::string& path,
-                        const std::string& id,
-                        int permissions)
+// the rules making up a watch of the given kind
+std::pair<const RuleSpec*, size_t> ruleSpecs(WatchKind kind)
 {
+    switch (kind) {
+        case WatchKind::File:
+        case WatchKind::Recursive:
+            return { allAccessTypes, 4 };
+        case WatchKind::Directory:
+            return { allAccessTypes, 1 };
+        default:
+            return { allAccessTypes, 0 };
+    }
+}
+
+Result<> applyRule(RuleSink& sink,
+                   bool add,
+                   const std::string& path,
+                   WatchKind kind,
+                   const RuleSpec& spec,
+                   WatchId id,
+                   const Exclusions* exclusions)
+{
+    char key[32] = "key=";
+    key[4] = spec.access;
+    *std::to_chars(key + 5, key + sizeof(key) - 1, id, 36).ptr = '\0';
+
     auto rule = newAuditRuleData();
     ScopeGuard freeRule([&]() { audit_rule_free_data(rule); });
 
-    RETURN_IF_C_ERROR(audit_add_watch_dir(
-        this->isDir ? AUDIT_DIR : AUDIT_WATCH, &rule, path.c_str()));
-    RETURN_IF_C_ERROR(audit_rule_syscallbyname_data(rule, "all"));
-    RETURN_IF_C_ERROR(audit_update_watch_perms(rule, permissions));
-
-    std::string key = "key=" + id;
     RETURN_IF_C_ERROR(
-        audit_rule_fieldpair_data(&rule, key.c_str(), AUDIT_FILTER_UNSET));
-    RETURN_IF_C_ERROR(audit_add_rule_data(
-        this->auditFd, rule, AUDIT_FILTER_EXIT, AUDIT_ALWAYS));
+        audit_add_watch_dir(kind == WatchKind::File ? AUDIT_WATCH : AUDIT_DIR,
+                            &rule,
+                            path.c_str()));
+    if (auto mask = scopedSyscalls(spec.permissions)) {
+        for (size_t i = 0; i < AUDIT_BITMASK_SIZE; ++i) {
+            rule->mask[i] |= mask->bits[i];
+        }
+    } else {
+        RETURN_IF_C_ERROR(audit_rule_syscallbyname_data(rule, "all"));
+    }
+    RETURN_IF_C_ERROR(audit_update_watch_perms(rule, spec.permissions));
+    RETURN_IF_C_ERROR(
+        audit_rule_fieldpair_data(&rule, key, AUDIT_FILTER_UNSET));
+    if (exclusions != nullptr) {
+        RETURN_IF_ERROR(exclusions->addRuleFields(&rule));
+    }
 
-    this->rules.push_back(rule);
-    freeRule.disable();
+    return add ? sink.addRule(rule) : sink.deleteRule(rule);
+}
 
-    return NO_ERROR;
 }
 
-Watch::Watch(Watch&& other)
-    : rules(std::move(other.rules))
-    , isDir(other.isDir)
-    , auditFd(other.auditFd)
+void setRuleSyscalls(RuleSyscalls syscalls)
 {
-    other.rules.clear();
+    ruleSyscalls = syscalls;
 }
 
-Watch::~Watch()
+std::optional<WatchId> parseWatchId(std::string_view id)
 {
-    for (const auto& rule : this->rules) {
-        if (audit_delete_rule_data(
-                this->auditFd, rule, AUDIT_FILTER_EXIT, AUDIT_ALWAYS) < 0) {
-            LOG << __FILE__ << ":" << __LINE__ << ": " << strerror(errno)
-                << std::endl;
-        }
-        audit_rule_free_data(rule);
+    WatchId result;
+    auto end = id.data() + id.size();
+    auto res = std::from_chars(id.data(), end, result, 36);
+    if (res.ec != std::errc() || res.ptr != end || id.empty()) {
+        return std::nullopt;
     }
+    return result;
 }
 
-Result<Watch> Watch::create(int auditFd,
-                            const std::string& path,
-                            bool isDirectory)
+Result<> addWatchRules(RuleSink& sink,
+                       const std::string& path,
+                       WatchKind kind,
+                       WatchId id,
+                       const Exclusions* exclusions)
 {
-    Watch watch(auditFd, isDirectory);
-    watch.isDir = isDirectory;
-    RETURN_IF_ERROR(watch.addRule(path, "w" + path, AUDIT_PERM_WRITE));
-    if (!isDirectory) {
-        RETURN_IF_ERROR(watch.addRule(path, "r" + path, AUDIT_PERM_READ));
-        RETURN_IF_ERROR(watch.addRule(path, "x" + path, AUDIT_PERM_EXEC));
-        RETURN_IF_ERROR(watch.addRule(path, "a" + path, AUDIT_PERM_ATTR));
+    auto specs = ruleSpecs(kind);
+    for (size_t i = 0; i < specs.second; ++i) {
+        auto res = applyRule(
+            sink, true /*add*/, path, kind, specs.first[i], id, exclusions);
+        if (res.isError()) {
+            size_t leftOver = 0;
+            for (size_t j = 0; j < i; ++j) {
+                auto undo = applyRule(sink,
+                                      false /*add*/,
+                                      path,
+                                      kind,
+                                      specs.first[j],
+                                      id,
+                                      exclusions);
+                if (undo.isError()) {
+                    LOG << std::get<0>(undo).message << std::endl;
+                    leftOver++;
+                }
+            }
+            if (leftOver > 0) {
+                return ERROR(std::get<0>(res).message +
+                             "; rollback incomplete, " +
+                             std::to_string(leftOver) + " rule(s) for " +
+                             path + " left in the kernel");
+            }
+            return res;
+        }
     }
-    return std::move(watch);
+    return NO_ERROR;
 }
 
-DirectoryWatch::DirectoryWatch(std::string path, int auditFd)
-    : path(std::move(path))
-    , pathParts(this->path)
-    , auditFd(auditFd)
-{}
+Result<> deleteWatchRules(RuleSink& sink,
+                          const std::string& path,
+                          WatchKind kind,
+                          WatchId id,
+                          const Exclusions* exclusions)
+{
+    auto specs = ruleSpecs(kind);
+    for (size_t i = 0; i < specs.second; ++i) {
+        RETURN_IF_ERROR(applyRule(
+            sink, false /*add*/, path, kind, specs.first[i], id, exclusions));
+    }
+    return NO_ERROR;
+}
 
-Result<DirectoryWatch> DirectoryWatch::create(int auditFd,
-                                              const std::string& path)
+WatchTree::WatchTree(RuleSink& sink,
+                     size_t scanThreads,
+                     const Exclusions* exclusions)
+    : firstFree(none)
+    , lastFree(none)
+    , sink(sink)
+    , scanThreads(scanThreads)
+    , exclusions(exclusions)
+    , rules(0)
 {
-    DirectoryWatch res(path, auditFd);
-    RETURN_OR_SET(auto w, Watch::create(auditFd, path, true /*isDirectory*/));
-    res.watch = std::make_shared<Watch>(std::move(w));
+    this->nodes.push_back(Node{ none,
+                                this->names.acquire(""),
+                                none,
+                                none,
+                                none,
+                                WatchKind::None,
+                                true,
+                                false });
+}
 
-    for (const auto& entry : std::filesystem::directory_iterator(path)) {
-        if (entry.is_regular_file()) {
-            RETURN_OR_SET(
-                auto w,
-                Watch::create(auditFd, entry.path(), false /*isDirectory*/));
-            res.files.emplace(entry.path().filename(), std::move(w));
-        } else if (entry.is_directory()) {
-            RETURN_OR_SET(auto w,
-                          DirectoryWatch::create(auditFd, entry.path()));
-            res.dirs.emplace(entry.path().filename(), std::move(w));
-        }
+WatchTree::~WatchTree()
+{
+    // the rules are queued for deletion, and then go in bulk
+    while (this->nodes[0].firstChild != none) {
+        this->removeNode(this->nodes[0].firstChild);
     }
+    if (auto res = this->sink.flush(); res.isError()) {
+        LOG << std::get<0>(res).message << std::endl;
+    }
+}
 
-    return std::move(res);
+bool WatchTree::isExcluded(std::string_view path) const
+{
+    return this->exclusions != nullptr && this->exclusions->excludesPath(path);
 }
 
-bool DirectoryWatch::contains(const PathParts& path) const
+size_t WatchTree::childHash(NodeIndex parent, NameId name) const
 {
-    return !path.tryRemoveRoot(this->pathParts).isError();
+    return mixHash(uint64_t(parent) << 32 | name);
 }
 
-Result<PathParts> DirectoryWatch::getRelPath(const PathParts& path) const
+WatchTree::NodeIndex WatchTree::findChild(NodeIndex parent,
+                                          std::string_view name) const
 {
-    return path.tryRemoveRoot(this->pathParts);
+    auto nameId = this->names.find(name);
+    if (!nameId) {
+        return none;
+    }
+    auto child = this->children.find(
+        this->childHash(parent, *nameId), [&](NodeIndex i) {
+            return this->nodes[i].parent == parent &&
+                   this->nodes[i].name == *nameId;
+        });
+    return child ? *child : none;
 }
 
-Result<> DirectoryWatch::watchPath(const PathParts& relPath)
+WatchTree::NodeIndex WatchTree::addNode(NodeIndex parent, std::string_view name)
 {
-    if (relPath.getParts().empty()) {
-        return ERROR("empty relpath");
+    NodeIndex index = this->firstFree;
+    if (index == none) {
+        index = this->nodes.size();
+        this->nodes.emplace_back();
+    } else {
+        this->firstFree = this->nodes[index].nextSibling;
+        if (this->firstFree == none) {
+            this->lastFree = none;
+        }
     }
 
-    if (relPath.getParts().size() == 1) {
-        auto name = relPath.getParts().back();
-        if (this->files.count(name) > 0 || this->dirs.count(name) > 0) {
-            return NO_ERROR;
+    auto& siblings = this->nodes[parent].firstChild;
+    this->nodes[index] = Node{ parent,
+                               this->names.acquire(name),
+                               none,
+                               none,
+                               siblings,
+                               WatchKind::None,
+                               true,
+                               false };
+    if (siblings != none) {
+        this->nodes[siblings].previousSibling = index;
+    }
+    siblings = index;
+    this->children.insert(index, [this](NodeIndex i) {
+        return this->childHash(this->nodes[i].parent, this->nodes[i].name);
+    });
+    return index;
+}
+
+void WatchTree::removeNode(NodeIndex index)
+{
+    auto& node = this->nodes[index];
+    if (node.previousSibling != none) {
+        this->nodes[node.previousSibling].nextSibling = node.nextSibling;
+    } else {
+        this->nodes[node.parent].firstChild = node.nextSibling;
+    }
+    if (node.nextSibling != none) {
+        this->nodes[node.nextSibling].previousSibling = node.previousSibling;
+    }
+
+    // the rules have to be rebuilt for deletion, so the paths are needed
+    std::string path;
+    this->buildPath(node.parent, path);
+    // nodes to remove, with the length of their parent's path
+    std::vector<std::pair<NodeIndex, size_t>> pending = {
+        { index, path.size() }
+    };
+    while (!pending.empty()) {
+        auto [next, parentLength] = pending.back();
+        pending.pop_back();
+        auto& removed = this->nodes[next];
+        path.resize(parentLength);
+        path.append("/").append(this->names.get(removed.name));
+        for (auto child = removed.firstChild; child != none;
+             child = this->nodes[child].nextSibling) {
+            pending.emplace_back(child, path.size());
+        }
+
+        if (auto res = deleteWatchRules(
+                this->sink, path, removed.kind, next, this->exclusions);
+            res.isError()) {
+            LOG << std::get<0>(res).message << std::endl;
         }
 
-        auto fullPath = this->path + "/" + relPath.getParts().back();
-        auto type = std::filesystem::status(fullPath).type();
-        if (type == std::filesystem::file_type::directory) {
-            RETURN_OR_SET(auto w,
-                          DirectoryWatch::create(this->auditFd, fullPath));
-            this->dirs.emplace(relPath.getParts().back(), std::move(w));
-        } else if (type == std::filesystem::file_type::regular) {
-            RETURN_OR_SET(
-                auto w,
-                Watch::create(this->auditFd, fullPath, false /*isDirectory*/));
-            this->files.emplace(relPath.getParts().back(), std::move(w));
+        this->children.erase(next, [this](NodeIndex i) {
+            return this->childHash(this->nodes[i].parent, this->nodes[i].name);
+        });
+        this->names.release(removed.name);
+        this->rules -= ruleSpecs(removed.kind).second;
+        removed.kind = WatchKind::None;
+        removed.inUse = false;
+        removed.nextSibling = none;
+        if (this->lastFree == none) {
+            this->firstFree = next;
         } else {
-            return ERROR("invalid file type");
+            this->nodes[this->lastFree].nextSibling = next;
         }
+        this->lastFree = next;
+    }
+}
+
+Result<> WatchTree::addRoot(const std::string& path, WatchMode mode)
+{
+    auto loc = this->locate(path);
+    if (loc.watched) {
+        // already covered by another root
         return NO_ERROR;
     }
-    auto childIt = this->dirs.find(relPath.getParts().front());
-    if (childIt == this->dirs.end()) {
-        return ERROR("child not found " + relPath.getParts().front());
+    if (this->isExcluded(path)) {
+        LOG << "not watching " << path << ", it's excluded" << std::endl;
+        return NO_ERROR;
+    }
+
+    bool recursive = mode == WatchMode::Directory;
+    if (recursive && loc.rest.empty() &&
+        this->nodes[loc.node].firstChild != none) {
+        // other roots under this one would be found instead of it
+        LOG << "can't watch " << path
+            << " in directory mode, it contains other roots" << std::endl;
+        recursive = false;
+    }
+
+    auto node = loc.node;
+    auto firstNew = none;
+    forEachComponent(loc.rest, [&](std::string_view name) {
+        node = this->addNode(node, name);
+        if (firstNew == none) {
+            firstNew = node;
+        }
+    });
+    ScopeGuard removeNew([&]() {
+        if (firstNew != none) {
+            this->removeNode(firstNew);
+        }
+    });
+    auto kind = recursive ? WatchKind::Recursive : WatchKind::Directory;
+    RETURN_IF_ERROR(
+        addWatchRules(this->sink, path, kind, node, this->exclusions));
+    removeNew.disable();
+    this->nodes[node].kind = kind;
+    this->rules += ruleSpecs(kind).second;
+    this->nodes[node].isRoot = true;
+
+    if (!recursive) {
+        RETURN_IF_ERROR(this->watchDirectory(node, path, this->scanThreads));
+    }
+    return this->sink.flush();
+}
+
+Result<> WatchTree::watchDirectory(NodeIndex node,
+                                   const std::string& path,
+                                   size_t threads)
+{
+    // nodes of the directories found so far by walk index, none if the
+    // entries under them are skipped
+    std::vector<NodeIndex> dirs = { node };
+    return walkTree(path, threads, [&](const TreeEntry& entry) -> Result<> {
+        if (entry.isDirectory && dirs.size() <= entry.index) {
+            dirs.resize(entry.index + 1, none);
+        }
+        auto parent = dirs[entry.parent];
+        if (parent == none || this->findChild(parent, entry.name()) != none) {
+            // a root that was added earlier, or something under it, or an
+            // excluded directory
+            return NO_ERROR;
+        }
+        if (this->isExcluded(entry.path)) {
+            return NO_ERROR;
+        }
+        RETURN_OR_SET(auto child,
+                      this->addEntry(
+                          parent, entry.name(), entry.path, entry.isDirectory));
+        if (entry.isDirectory) {
+            dirs[entry.index] = child;
+        }
+        return NO_ERROR;
+    });
+}
+
+Result<WatchTree::NodeIndex> WatchTree::addEntry(NodeIndex parent,
+                                                 std::string_view name,
+                                                 const std::string& path,
+                                                 bool isDirectory)
+{
+    auto node = this->addNode(parent, name);
+    auto kind = isDirectory ? WatchKind::Directory : WatchKind::File;
+    ScopeGuard removeNew([&]() { this->removeNode(node); });
+    RETURN_IF_ERROR(
+        addWatchRules(this->sink, path, kind, node, this->exclusions));
+    removeNew.disable();
+    this->nodes[node].kind = kind;
+    this->rules += ruleSpecs(kind).second;
+    return node;
+}
+
+Result<> WatchTree::watchEntry(NodeIndex parent,
+                               std::string_view name,
+                               const std::string& path)
+{
+    auto type = std::filesystem::status(path).type();
+    if (type != std::filesystem::file_type::directory &&
+        type != std::filesystem::file_type::regular) {
+        return ERROR("invalid file type");
     }
+    bool isDirectory = type == std::filesystem::file_type::directory;
 
-    RETURN_IF_ERROR(childIt->second.watchPath(relPath.childPath()));
+    RETURN_OR_SET(auto node, this->addEntry(parent, name, path, isDirectory));
+    if (isDirectory) {
+        // usually empty when it's just been created, not worth more threads
+        RETURN_IF_ERROR(this->watchDirectory(node, path, 1));
+    }
     return NO_ERROR;
 }
 
-Result<> DirectoryWatch::unwatchPath(const PathParts& relPath)
+WatchTree::Location WatchTree::locate(std::string_view path) const
 {
-    if (relPath.getParts().empty()) {
-        return ERROR("empty relpath");
+    NodeIndex node = 0;
+    size_t pos = 1;
+    while (pos < path.size()) {
+        size_t end = std::min(path.find('/', pos), path.size());
+        auto child = this->findChild(node, path.substr(pos, end - pos));
+        if (child == none) {
+            break;
+        }
+        node = child;
+        pos = end + 1;
     }
+    auto rest = pos < path.size() ? path.substr(pos) : std::string_view();
+    return Location{ node, rest, this->nodes[node].kind != WatchKind::None };
+}
 
-    if (relPath.getParts().size() == 1) {
-        auto name = relPath.getParts().back();
-        this->files.erase(name);
-        this->dirs.erase(name);
+Result<> WatchTree::watchPath(const Location& loc, const std::string& path)
+{
+    if (!loc.watched || loc.rest.empty() ||
+        this->nodes[loc.node].kind == WatchKind::Recursive) {
+        return NO_ERROR;
+    }
+    if (loc.rest.find('/') != std::string_view::npos) {
+        return ERROR("parent not watched: " + path);
+    }
+    if (this->isExcluded(path)) {
         return NO_ERROR;
     }
+    RETURN_IF_ERROR(this->watchEntry(loc.node, loc.rest, path));
+    return this->sink.flush();
+}
 
-    auto childIt = this->dirs.find(relPath.getParts().front());
-    if (childIt == this->dirs.end()) {
-        return ERROR("child not found");
+Result<> WatchTree::unwatchPath(const Location& loc)
+{
+    if (!loc.watched || this->nodes[loc.node].kind == WatchKind::Recursive) {
+        return NO_ERROR;
+    }
+    if (!loc.rest.empty()) {
+        if (loc.rest.find('/') != std::string_view::npos) {
+            return ERROR("parent not watched");
+        }
+        // the entry wasn't watched in the first place
+        return NO_ERROR;
     }
+    if (this->nodes[loc.node].isRoot) {
+        return ERROR("can't unwatch a root directory");
+    }
+    this->removeNode(loc.node);
+    return this->sink.flush();
+}
 
-    RETURN_IF_ERROR(childIt->second.unwatchPath(relPath.childPath()));
-    return NO_ERROR;
+void WatchTree::buildPath(NodeIndex index, std::string& path) const
+{
+    size_t length = 0;
+    for (auto node = index; node != 0; node = this->nodes[node].parent) {
+        length += this->names.get(this->nodes[node].name).size() + 1;
+    }
+    path.assign(length, '/');
+    for (auto node = index; node != 0; node = this->nodes[node].parent) {
+        auto name = this->names.get(this->nodes[node].name);
+        length -= name.size();
+        path.replace(length, name.size(), name);
+        length--;
+    }
+}
+
+bool WatchTree::pathOf(WatchId id, std::string& path) const
+{
+    if (id >= this->nodes.size() || !this->nodes[id].inUse ||
+        this->nodes[id].kind == WatchKind::None) {
+        return false;
+    }
+    this->buildPath(id, path);
+    return true;
+}
+
+size_t WatchTree::ruleCount() const
+{
+    return this->rules;
+}
+
+WatchTree::MemoryUsage WatchTree::memoryUsage() const
+{
+    MemoryUsage usage{ 0, 0 };
+    usage.bytes = this->nodes.capacity() * sizeof(Node) + this->names.bytes() +
+                  this->children.bytes();
+    for (const auto& node : this->nodes) {
+        if (node.inUse) {
+            usage.nodes++;
+        }
+    }
+    return usage;
 }
@@ -1,61 +1,194 @@
 #pragma once
 
-#include <map>
-#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <libaudit.h>
 
+#include <config.hpp>
+#include <exclude.hpp>
+#include <idindex.hpp>
+#include <names.hpp>
+#include <rules.hpp>
 #include <util.hpp>
 
-class Watch
-{
-    std::vector<audit_rule_data*> rules;
-    bool isDir;
-    int auditFd;
-
-    Watch(int auditFd, bool isDir);
-
-    Result<> addRule(const std::string& path,
-                     const std::string& id,
-                     int permissions);
-
-public:
-    Watch(const Watch&) = delete;
-    Watch& operator=(const Watch&) = delete;
-    Watch& operator=(Watch&&) = delete;
-
-    Watch(Watch&& other);
+// Identifies a watched path in the rule keys. A key is an access type letter
+// followed by the id in base 36, e.g. "r1k", so it stays short however long
+// the path is.
+using WatchId = uint32_t;
 
-    ~Watch();
+// Parses the id part of a rule key, without the access type letter.
+std::optional<WatchId> parseWatchId(std::string_view id);
 
-    static Result<Watch> create(int auditFd,
-                                const std::string& path,
-                                bool isDirectory);
-
-    bool isDirectory() const { return this->isDir; }
+enum class WatchKind : uint8_t
+{
+    // not watched, only leads to watched paths
+    None,
+    // read, write, execute and attribute rules on a file
+    File,
+    // a write rule on a directory, for entries created and deleted in it
+    Directory,
+    // Every access type on a whole directory tree, with one recursive rule
+    // per access type. The kernel reports the accessed paths, so the tree
+    // doesn't have to be scanned.
+    Recursive
 };
 
-class DirectoryWatch
+// Which syscalls watch rules apply to. The kernel evaluates every exit rule
+// whose syscall mask has the current syscall, so with All every rule is
+// looked at on every syscall on the machine. Scoped rules only have the
+// syscalls that can match their permission, in both the native and the 32
+// bit ABI; everything else passes them after a bit test.
+enum class RuleSyscalls
 {
-    std::shared_ptr<Watch> watch;
-    std::map<std::string, Watch> files;
-    std::map<std::string, DirectoryWatch> dirs;
-    std::string path;
-    PathParts pathParts;
-    int auditFd;
-
-    DirectoryWatch(std::string path, int auditFd);
+    Scoped,
+    All
+};
 
+// Sets the syscalls of rules built from now on, Scoped by default. Meant for
+// benchmarks and comparisons; rules have to be deleted with the setting they
+// were added with.
+void setRuleSyscalls(RuleSyscalls syscalls);
+
+// Adds the audit rules of a watch, with the rule fields of exclusions if set.
+// The rules are freed as soon as the sink has them; the same arguments
+// rebuild them for deleteWatchRules. If adding fails, the rules added so far
+// are deleted again.
+Result<> addWatchRules(RuleSink& sink,
+                       const std::string& path,
+                       WatchKind kind,
+                       WatchId id,
+                       const Exclusions* exclusions = nullptr);
+
+Result<> deleteWatchRules(RuleSink& sink,
+                          const std::string& path,
+                          WatchKind kind,
+                          WatchId id,
+                          const Exclusions* exclusions = nullptr);
+
+// Every watched path in a single trie of path components, starting at "/".
+// Nodes above the configured roots have no watch, they only lead to the roots.
+//
+// Nodes live in a flat table and refer to each other by index. Names are
+// interned, and children are found through one hash index keyed by (parent,
+// name), so a node takes a few dozen bytes whatever its depth. Full paths
+// are rebuilt from the parents when needed. The index of a watched node is
+// also the id in its rule keys.
+class WatchTree
+{
 public:
-    static Result<DirectoryWatch> create(int auditFd, const std::string& path);
-
-    bool contains(const PathParts& path) const;
+    using NodeIndex = WatchId;
+
+private:
+    static constexpr NodeIndex none = UINT32_MAX;
+
+    struct Node
+    {
+        NodeIndex parent;
+        NameId name;
+        NodeIndex firstChild;
+        NodeIndex previousSibling;
+        // next free node for unused nodes
+        NodeIndex nextSibling;
+        // None for nodes above the roots and unused nodes. Recursive watches
+        // cover the whole subtree, they have no child nodes.
+        WatchKind kind;
+        bool inUse;
+        bool isRoot;
+    };
+
+    // nodes[0] is "/"
+    std::vector<Node> nodes;
+    // Unused nodes, linked through nextSibling, oldest first. Indices are
+    // reused as late as possible, so that events still in flight for a
+    // deleted entry are unlikely to resolve to a new one.
+    NodeIndex firstFree;
+    NodeIndex lastFree;
+    NameTable names;
+    // (parent, name) -> node
+    IdIndex children;
+    RuleSink& sink;
+    size_t scanThreads;
+    const Exclusions* exclusions;
+    // audit rules of all watches
+    size_t rules;
+
+    bool isExcluded(std::string_view path) const;
+
+    size_t childHash(NodeIndex parent, NameId name) const;
+    NodeIndex findChild(NodeIndex parent, std::string_view name) const;
+    NodeIndex addNode(NodeIndex parent, std::string_view name);
+    // Removes node and everything under it, deleting their rules.
+    void removeNode(NodeIndex node);
+    void buildPath(NodeIndex node, std::string& path) const;
+
+    // Watches everything under node, which must be a directory at path.
+    Result<> watchDirectory(NodeIndex node,
+                            const std::string& path,
+                            size_t threads);
+
+    // Watches a single entry, without anything under it.
+    Result<NodeIndex> addEntry(NodeIndex parent,
+                               std::string_view name,
+                               const std::string& path,
+                               bool isDirectory);
+
+    Result<> watchEntry(NodeIndex parent,
+                        std::string_view name,
+                        const std::string& path);
 
-    Result<PathParts> getRelPath(const PathParts& path) const;
-
-    Result<> watchPath(const PathParts& relPath);
-
-    Result<> unwatchPath(const PathParts& relPath);
-};
\ No newline at end of file
+public:
+    // Where a path ends up in the tree
+    struct Location
+    {
+        // deepest node on the path
+        NodeIndex node;
+        // the part of the path below node, empty if node is the path itself
+        std::string_view rest;
+        // true if the path is under one of the roots
+        bool watched;
+    };
+
+    struct MemoryUsage
+    {
+        size_t nodes;
+        // the node table, names and child index
+        size_t bytes;
+    };
+
+    // scanThreads is the number of threads reading directories when a root
+    // is added. Excluded paths are not watched, and every rule gets the rule
+    // fields of exclusions, which must outlive the tree.
+    WatchTree(RuleSink& sink,
+              size_t scanThreads = 1,
+              const Exclusions* exclusions = nullptr);
+
+    WatchTree(const WatchTree&) = delete;
+    WatchTree& operator=(const WatchTree&) = delete;
+
+    // Deletes all rules.
+    ~WatchTree();
+
+    // path must be normalized
+    Result<> addRoot(const std::string& path, WatchMode mode);
+
+    // Walks a normalized path down the tree, without allocating.
+    Location locate(std::string_view path) const;
+
+    // Starts watching a newly created entry. path must be the normalized path
+    // that loc was located from.
+    Result<> watchPath(const Location& loc, const std::string& path);
+
+    // Stops watching a deleted entry and everything under it.
+    Result<> unwatchPath(const Location& loc);
+
+    // Looks up the path that the rule with the given id watches. Returns false
+    // if the id is not in use.
+    bool pathOf(WatchId id, std::string& path) const;
+
+    size_t ruleCount() const;
+
+    MemoryUsage memoryUsage() const;
+};